@@ -1,15 +1,26 @@
 #pragma once
 
+#include <memory>
+#include <stdexcept>
+
+#include "btree.h"
 #include "intrusive_tree.h"
 
 struct left_tag {};
 struct right_tag {};
 
+// Индекс каждой из сторон выбирается отдельно:
+// intrusive::intrusive_tree (декартово дерево, по умолчанию) или
+// intrusive::btree (B+-дерево, выгоднее для больших map'ов маленьких ключей).
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          template <typename, typename, typename> typename LeftIndex =
+              intrusive::intrusive_tree,
+          template <typename, typename, typename> typename RightIndex =
+              intrusive::intrusive_tree>
 struct bimap
-    : private intrusive::intrusive_tree<Left, CompareLeft, left_tag>,
-      private intrusive::intrusive_tree<Right, CompareRight, right_tag> {
+    : private LeftIndex<Left, CompareLeft, left_tag>,
+      private RightIndex<Right, CompareRight, right_tag> {
 
   template <typename T>
   struct iterator;
@@ -22,8 +33,8 @@ private:
   using left_comp_t = CompareLeft;
   using right_comp_t = CompareRight;
 
-  using left_tree_t = intrusive::intrusive_tree<left_t, left_comp_t, left_tag>;
-  using right_tree_t = intrusive::intrusive_tree<right_t, right_comp_t, right_tag>;
+  using left_tree_t = LeftIndex<left_t, left_comp_t, left_tag>;
+  using right_tree_t = RightIndex<right_t, right_comp_t, right_tag>;
 
   using left_node_t = typename left_tree_t::node_t;
   using right_node_t = typename right_tree_t ::node_t;
@@ -36,12 +47,85 @@ private:
 
   struct node_t : left_node_t, right_node_t {
 
-    template <typename L = left_t, typename R = right_t>
-    node_t(L&& left, R&& right) noexcept
+    template <typename L, typename R>
+    node_t(L&& left, R&& right)
         : left_node_t(std::forward<L>(left)),
           right_node_t(std::forward<R>(right)) {}
+
+    node_t(node_t&& other) noexcept
+        : left_node_t(std::move(static_cast<left_node_t&>(other))),
+          right_node_t(std::move(static_cast<right_node_t&>(other))) {}
+  };
+
+  // Узлы, перенесенные compact(), лежат в одном непрерывном блоке
+  struct slab_t {
+    node_t* data{nullptr};
+    size_t capacity{0};
+    size_t alive{0};
+
+    bool contains(const node_t* node) const noexcept {
+      std::less<const node_t*> less;
+      return !less(node, data) && less(node, data + capacity);
+    }
+
+    void release() noexcept {
+      std::allocator<node_t>().deallocate(data, capacity);
+      *this = slab_t();
+    }
   };
 
+  void free_node(node_t* node) noexcept {
+    if (!slab.contains(node)) {
+      delete node;
+      return;
+    }
+    node->~node_t();
+    if (--slab.alive == 0) {
+      slab.release();
+    }
+  }
+
+  // Ключ кладется либо в узел (intrusive_tree), либо в сам индекс (btree)
+  template <typename Tree, typename K>
+  static decltype(auto) node_key(K&& key) noexcept {
+    if constexpr (Tree::key_in_node) {
+      return std::forward<K>(key);
+    } else {
+      return intrusive::no_key{};
+    }
+  }
+
+  template <typename Tree, typename K>
+  static typename Tree::iterator link_node(Tree& tree,
+                                           typename Tree::node_t* node,
+                                           K&& key) {
+    if constexpr (Tree::key_in_node) {
+      return tree.insert(node);
+    } else {
+      return tree.insert(node, std::forward<K>(key));
+    }
+  }
+
+  template <typename L, typename R>
+  typename left_tree_t::iterator insert_node(L&& left, R&& right) {
+    auto* node = new node_t(node_key<left_tree_t>(std::forward<L>(left)),
+                            node_key<right_tree_t>(std::forward<R>(right)));
+    try {
+      link_node(get_right_tree(), to_right_node(node), std::forward<R>(right));
+    } catch (...) {
+      delete node;
+      throw;
+    }
+    try {
+      return link_node(get_left_tree(), to_left_node(node),
+                       std::forward<L>(left));
+    } catch (...) {
+      get_right_tree().erase(right_tree_t::iterator_to(to_right_node(node)));
+      delete node;
+      throw;
+    }
+  }
+
   static left_node_t* to_left_node(node_t* node) {
     return static_cast<left_node_t*>(node);
   }
@@ -67,16 +151,20 @@ private:
   }
 
   size_t sz{};
+  slab_t slab{};
 
 public:
-  template <typename V, typename Comp, typename Tag>
-  struct iterator<intrusive::intrusive_tree<V, Comp, Tag>> {
+  template <typename Tree>
+  struct iterator {
 
     template <typename OtherTree>
     friend struct iterator;
 
     friend bimap;
 
+    using V = typename Tree::key_type;
+    using Tag = typename Tree::tag_type;
+
     using iterator_category = std::bidirectional_iterator_tag;
     using value_type = std::remove_const_t<V>;
     using reference = value_type&;
@@ -139,36 +227,25 @@ public:
 
       using opposite_iterator = std::conditional_t<std::is_same_v<Tag, left_tag>,
           right_iterator, left_iterator>;
-      using opposite_iterator_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
-          right_iterator_t, left_iterator_t>;
-      using opposite_tag = std::conditional_t<std::is_same_v<Tag, left_tag>,
-          right_tag, left_tag>;
       using opposite_tree_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
           right_tree_t, left_tree_t>;
       using opposite_node_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
           right_node_t, left_node_t>;
-      using tree_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
-          left_tree_t, right_tree_t>;
 
-      if (it.get_base()->parent == nullptr) {
+      if (auto* tree = Tree::end_owner(it)) {
         // == end_left()
+        auto* map = static_cast<const bimap*>(static_cast<const Tree*>(tree));
         return opposite_iterator(
-            opposite_iterator_t(
-                static_cast<intrusive::tree_element<opposite_tag>*>(
-                    static_cast<opposite_tree_t*>(
-                        static_cast<bimap*>(
-                            static_cast<tree_t*>(
-                                it.get_elem()))))));
+            static_cast<opposite_tree_t&>(const_cast<bimap&>(*map)).end());
       }
       return opposite_iterator(
-          opposite_iterator_t(
+          opposite_tree_t::iterator_to(
               static_cast<opposite_node_t*>(
                   static_cast<node_t*>(it.get_node()))));
     }
 
   private:
-    using tree_iterator_t =
-        typename intrusive::intrusive_tree<V, Comp, Tag>::iterator;
+    using tree_iterator_t = typename Tree::iterator;
 
     tree_iterator_t it{};
 
@@ -215,20 +292,68 @@ public:
     if (find_left(left) != end_left() || find_right(right) != end_right()) {
       return end_left();
     }
-    auto* node = new node_t(std::forward<L>(left), std::forward<R>(right));
+    left_iterator res(insert_node(std::forward<L>(left), std::forward<R>(right)));
     ++sz;
-    get_right_tree().insert(to_right_node(node));
-    return get_left_tree().insert(to_left_node(node));
+    return res;
   }
 
   left_iterator insert(const left_t& left, const right_t& right) {
     if (find_left(left) != end_left() || find_right(right) != end_right()) {
       return end_left();
     }
-    auto* node = new node_t(left, right);
+    left_iterator res(insert_node(left, right));
     ++sz;
-    get_right_tree().insert(to_right_node(node));
-    return get_left_tree().insert(to_left_node(node));
+    return res;
+  }
+
+  // Пара в узле вне bimap, как node_type у std::map: make_node выделяет
+  // память, а insert(node_handle&&) только связывает узел с деревьями, и
+  // вставку под мьютексом можно отделить от выделения. Только для индексов,
+  // которые хранят ключи в узлах.
+  class node_handle {
+  public:
+    node_handle() noexcept = default;
+
+    bool empty() const noexcept {
+      return !node;
+    }
+
+    const left_t& left() const noexcept {
+      return left_tree_t::key_of(to_left_node(node.get()));
+    }
+
+    const right_t& right() const noexcept {
+      return right_tree_t::key_of(to_right_node(node.get()));
+    }
+
+  private:
+    friend bimap;
+
+    explicit node_handle(node_t* node) noexcept : node(node) {}
+
+    std::unique_ptr<node_t> node;
+  };
+
+  template <typename L = left_t, typename R = right_t>
+  static node_handle make_node(L&& left, R&& right) {
+    static_assert(left_tree_t::key_in_node && right_tree_t::key_in_node,
+                  "node_handle needs indexes that keep keys in nodes");
+    return node_handle(new node_t(std::forward<L>(left), std::forward<R>(right)));
+  }
+
+  // Вставка пары из make_node, возвращает итератор на left. Если такой left
+  // или такой right уже присутствуют в bimap, узел остается в node и
+  // возвращается end_left().
+  left_iterator insert(node_handle&& node) {
+    if (find_left(node.left()) != end_left() ||
+        find_right(node.right()) != end_right()) {
+      return end_left();
+    }
+    node_t* raw = node.node.release();
+    get_right_tree().insert(to_right_node(raw));
+    left_iterator res(get_left_tree().insert(to_left_node(raw)));
+    ++sz;
+    return res;
   }
 
   // Удаляет элемент и соответствующий ему парный.
@@ -241,9 +366,11 @@ public:
       return end_left();
     }
     --sz;
+    node_t* node = from_left_node(it.it.get_node());
+    right_iterator pair = it.flip();
     left_iterator res = left_iterator(get_left_tree().erase(it.it));
-    get_right_tree().erase(it.flip().it);
-    delete from_left_node(it.it.get_node());
+    get_right_tree().erase(pair.it);
+    free_node(node);
     return res;
   }
 
@@ -263,9 +390,11 @@ public:
       return end_right();
     }
     --sz;
+    node_t* node = from_right_node(it.it.get_node());
+    left_iterator pair = it.flip();
     right_iterator res = right_iterator(get_right_tree().erase(it.it));
-    get_left_tree().erase(it.flip().it);
-    delete from_right_node(it.it.get_node());
+    get_left_tree().erase(pair.it);
+    free_node(node);
     return res;
   }
 
@@ -375,6 +504,33 @@ public:
     return get_right_tree().upper_bound(right);
   }
 
+  // Вызывает f(left, right) для пар с left из [lo, hi) в порядке возрастания
+  // left, пока f возвращает true. Спускается по дереву один раз и не создает
+  // итераторов, следующие узлы заранее подгружаются в кеш.
+  // f не должна изменять bimap.
+  template <typename F>
+  void scan_left(const left_t& lo, const left_t& hi, F&& f) const {
+    get_left_tree().scan(lo, hi, [&](left_node_t* left, const left_t& key,
+                                     left_node_t* ahead) {
+      if (ahead) {
+        intrusive::prefetch(from_left_node(ahead), sizeof(node_t));
+      }
+      return f(key, right_tree_t::key_of(to_right_node(from_left_node(left))));
+    });
+  }
+
+  // Аналогично scan_left, по right из [lo, hi); f вызывается как f(left, right)
+  template <typename F>
+  void scan_right(const right_t& lo, const right_t& hi, F&& f) const {
+    get_right_tree().scan(lo, hi, [&](right_node_t* right, const right_t& key,
+                                      right_node_t* ahead) {
+      if (ahead) {
+        intrusive::prefetch(from_right_node(ahead), sizeof(node_t));
+      }
+      return f(left_tree_t::key_of(to_left_node(from_right_node(right))), key);
+    });
+  }
+
   // Возващает итератор на минимальный по порядку left.
   left_iterator begin_left() const noexcept {
     return left_iterator(get_left_tree().begin());
@@ -425,5 +581,56 @@ public:
     std::swap(get_left_tree(), other.get_left_tree());
     std::swap(get_right_tree(), other.get_right_tree());
     std::swap(sz, other.sz);
+    std::swap(slab, other.slab);
+  }
+
+  // Сколько памяти занимает bimap: узлы, кучу ключей (через
+  // intrusive::heap_usage), структуры индексов и накладные расходы
+  // аллокатора. Работает за O(n).
+  intrusive::memory_stats memory_usage() const noexcept {
+    intrusive::memory_stats stats;
+    get_left_tree().memory_usage(stats);
+    get_right_tree().memory_usage(stats);
+    stats.nodes = sz * sizeof(node_t);
+    if (slab.data) {
+      stats.slack += (slab.capacity - slab.alive) * sizeof(node_t) +
+                     intrusive::allocation_slack(slab.data,
+                                                 slab.capacity * sizeof(node_t));
+    }
+    for (auto it = begin_left(); it != end_left(); ++it) {
+      node_t* node = from_left_node(it.it.get_node());
+      if (!slab.contains(node)) {
+        stats.slack += intrusive::allocation_slack(node, sizeof(node_t));
+      }
+    }
+    return stats;
+  }
+
+  // Переносит все узлы в один непрерывный блок в порядке возрастания left,
+  // возвращая локальность после большого числа вставок и удалений.
+  // Инвалидирует все итераторы, кроме end_left() и end_right().
+  void compact() {
+    if (empty()) {
+      return;
+    }
+    slab_t fresh;
+    fresh.data = std::allocator<node_t>().allocate(sz);
+    fresh.capacity = sz;
+    slab_t old = std::exchange(slab, fresh);
+    for (auto it = begin_left(); it != end_left();) {
+      node_t* node = from_left_node(it.it.get_node());
+      ++it;
+      node_t* moved = new (slab.data + slab.alive++) node_t(std::move(*node));
+      left_tree_t::replace(to_left_node(node), to_left_node(moved));
+      right_tree_t::replace(to_right_node(node), to_right_node(moved));
+      if (old.contains(node)) {
+        node->~node_t();
+      } else {
+        delete node;
+      }
+    }
+    if (old.data) {
+      old.release();
+    }
   }
 };
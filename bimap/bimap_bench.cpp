@@ -0,0 +1,291 @@
+// Замеры из README:
+// g++ -std=c++17 -O2 -DNDEBUG -pthread bimap_bench.cpp intrusive_tree.cpp -o bimap_bench
+// bimap_bench [index|compact|strings|scan|concurrent] -- без аргумента все
+// по очереди.
+// Печатает абсолютные времена и отношения, по которым составлены таблицы.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bimap.h"
+#include "sharded_bimap.h"
+
+namespace {
+
+volatile std::uint64_t sink;
+
+// Биекция на uint64_t: разные i дают разные ключи в случайном порядке
+std::uint64_t mix(std::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+template <typename F>
+double seconds(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+template <template <typename, typename, typename> typename Index>
+using u64_bimap = bimap<std::uint64_t, std::uint64_t, std::less<>,
+                        std::less<>, Index, Index>;
+
+template <typename B>
+double find_flip(const B& b, const std::vector<std::uint64_t>& keys) {
+  return seconds([&] {
+    std::uint64_t sum = 0;
+    for (std::uint64_t k : keys) {
+      sum += *b.find_left(k).flip();
+    }
+    sink = sum;
+  });
+}
+
+struct index_result {
+  double bytes_per_pair;
+  double insert;
+  double lookup;
+};
+
+// n случайных пар, затем n поисков find_left(x).flip() по случайным ключам
+template <template <typename, typename, typename> typename Index>
+index_result measure_index(std::size_t n) {
+  u64_bimap<Index> b;
+  index_result r;
+  r.insert = seconds([&] {
+    for (std::size_t i = 0; i < n; ++i) {
+      b.insert(mix(i), mix(i + n));
+    }
+  });
+  r.bytes_per_pair = static_cast<double>(b.memory_usage().total()) / n;
+  std::mt19937_64 random(1);
+  std::vector<std::uint64_t> keys(n);
+  for (std::uint64_t& k : keys) {
+    k = mix(random() % n);
+  }
+  r.lookup = find_flip(b, keys);
+  return r;
+}
+
+void bench_index() {
+  const std::size_t n = 10'000'000;
+  index_result treap = measure_index<intrusive::intrusive_tree>(n);
+  index_result tree = measure_index<intrusive::btree>(n);
+  std::printf("index, %zu pairs of uint64_t\n", n);
+  std::printf("  intrusive_tree: %.0f bytes/pair, insert %.2f s, "
+              "find+flip %.2f s\n",
+              treap.bytes_per_pair, treap.insert, treap.lookup);
+  std::printf("  btree:          %.0f bytes/pair, insert %.2f s (%.2f), "
+              "find+flip %.2f s (%.2f)\n",
+              tree.bytes_per_pair, tree.insert, tree.insert / treap.insert,
+              tree.lookup, tree.lookup / treap.lookup);
+}
+
+// Полный обход с flip() и n случайных поисков
+template <typename B>
+double walk_and_find(const B& b, const std::vector<std::uint64_t>& keys) {
+  double walk = seconds([&] {
+    std::uint64_t sum = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      sum += *it.flip();
+    }
+    sink = sum;
+  });
+  return walk + find_flip(b, keys);
+}
+
+void bench_compact() {
+  const std::size_t n = 2'000'000;
+  const std::size_t replacements = 4'000'000;
+  u64_bimap<intrusive::intrusive_tree> b;
+  std::vector<std::uint64_t> live(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    live[i] = mix(i);
+    b.insert(live[i], mix(i + n + replacements));
+  }
+  std::mt19937_64 random(2);
+  for (std::size_t i = 0; i < replacements; ++i) {
+    std::uint64_t& victim = live[random() % n];
+    b.erase_left(victim);
+    victim = mix(n + i);
+    b.insert(victim, mix(2 * n + replacements + i));
+  }
+  std::vector<std::uint64_t> keys(n);
+  for (std::uint64_t& k : keys) {
+    k = live[random() % n];
+  }
+  double before = walk_and_find(b, keys);
+  std::size_t slack_before = b.memory_usage().slack;
+  b.compact();
+  double after = walk_and_find(b, keys);
+  std::size_t slack_after = b.memory_usage().slack;
+  std::printf("compact, %zu pairs after %zu replacements\n", n,
+              replacements);
+  std::printf("  walk+find: %.2f s -> %.2f s (%.2fx), slack %.1f MB -> "
+              "%.1f MB\n",
+              before, after, before / after, slack_before / 1e6,
+              slack_after / 1e6);
+}
+
+// Сравнение без префикса: для другого компаратора key_storage пустая
+struct plain_less {
+  bool operator()(const std::string& a, const std::string& b) const {
+    return a < b;
+  }
+};
+
+template <typename Comp>
+double string_lookup(const std::vector<std::string>& keys,
+                     const std::vector<std::size_t>& probes) {
+  bimap<std::string, std::uint64_t, Comp> b;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    b.insert(keys[i], i);
+  }
+  return seconds([&] {
+    std::uint64_t sum = 0;
+    for (std::size_t p : probes) {
+      sum += *b.find_left(keys[p]).flip();
+    }
+    sink = sum;
+  });
+}
+
+std::string hex(std::mt19937_64& random, std::size_t length) {
+  std::string s(length, '0');
+  for (char& c : s) {
+    c = "0123456789abcdef"[random() % 16];
+  }
+  return s;
+}
+
+void bench_strings() {
+  const std::size_t n = 1'000'000;
+  std::mt19937_64 random(3);
+  std::vector<std::string> urls(n);
+  std::vector<std::string> ids(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    urls[i] = "https://shop.example.org/item/" + hex(random, 6) + "/" +
+              hex(random, 10);
+    ids[i] = hex(random, 24);
+  }
+  std::vector<std::size_t> probes(n);
+  for (std::size_t& p : probes) {
+    p = random() % n;
+  }
+  std::printf("strings, %zu keys, find+flip with / without prefix\n", n);
+  for (auto* set : {&urls, &ids}) {
+    double with = string_lookup<std::less<std::string>>(*set, probes);
+    double without = string_lookup<plain_less>(*set, probes);
+    std::printf("  %-4s: %.2f s / %.2f s (%.2f)\n",
+                set == &urls ? "url" : "id", with, without, with / without);
+  }
+}
+
+// ranges диапазонов примерно по width пар: scan_left против
+// lower_bound_left + ++ + flip()
+template <template <typename, typename, typename> typename Index>
+void measure_scan(const char* name, std::size_t n) {
+  const std::size_t ranges = 2000;
+  const std::size_t width = 1000;
+  u64_bimap<Index> b;
+  for (std::size_t i = 0; i < n; ++i) {
+    b.insert(mix(i), mix(i + n));
+  }
+  std::uint64_t span = UINT64_MAX / n * width;
+  std::mt19937_64 random(4);
+  std::vector<std::uint64_t> starts(ranges);
+  for (std::uint64_t& lo : starts) {
+    lo = random() % (UINT64_MAX - span);
+  }
+  double iterate = seconds([&] {
+    std::uint64_t sum = 0;
+    for (std::uint64_t lo : starts) {
+      for (auto it = b.lower_bound_left(lo);
+           it != b.end_left() && *it < lo + span; ++it) {
+        sum += *it.flip();
+      }
+    }
+    sink = sum;
+  });
+  double scan = seconds([&] {
+    std::uint64_t sum = 0;
+    for (std::uint64_t lo : starts) {
+      b.scan_left(lo, lo + span, [&](std::uint64_t, std::uint64_t right) {
+        sum += right;
+        return true;
+      });
+    }
+    sink = sum;
+  });
+  std::printf("  %-14s: iterators %.3f s, scan %.3f s (%.2fx)\n", name,
+              iterate, scan, iterate / scan);
+}
+
+void bench_scan() {
+  const std::size_t n = 2'000'000;
+  std::printf("scan, %zu pairs, 2000 ranges of ~1000 pairs\n", n);
+  measure_scan<intrusive::intrusive_tree>("intrusive_tree", n);
+  measure_scan<intrusive::btree>("btree", n);
+}
+
+// n пар вставляются в sharded_bimap из threads потоков поровну
+double concurrent_insert(std::size_t n, unsigned threads) {
+  sharded_bimap<std::uint64_t, std::uint64_t> b;
+  std::vector<std::thread> workers;
+  return seconds([&] {
+    for (unsigned t = 0; t < threads; ++t) {
+      workers.emplace_back([&b, n, threads, t] {
+        for (std::size_t i = t; i < n; i += threads) {
+          b.insert(mix(i), mix(i + n));
+        }
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  });
+}
+
+void bench_concurrent() {
+  const std::size_t n = 1'000'000;
+  std::printf("concurrent, %zu pairs of uint64_t into sharded_bimap, "
+              "%u hardware threads\n",
+              n, std::thread::hardware_concurrency());
+  double single = 0;
+  for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+    double time = concurrent_insert(n, threads);
+    if (threads == 1) {
+      single = time;
+    }
+    std::printf("  %2u threads: %.2f s, %.2f M pairs/s (%.2fx)\n", threads,
+                time, n / time / 1e6, single / time);
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const char* only = argc > 1 ? argv[1] : nullptr;
+  auto run = [&](const char* name, void (*bench)()) {
+    if (!only || !std::strcmp(only, name)) {
+      bench();
+    }
+  };
+  run("index", bench_index);
+  run("compact", bench_compact);
+  run("strings", bench_strings);
+  run("scan", bench_scan);
+  run("concurrent", bench_concurrent);
+  return 0;
+}
@@ -0,0 +1,669 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <utility>
+
+#include "intrusive_tree.h"
+
+namespace intrusive {
+
+// Двусвязное кольцо листьев. Само дерево -- фиктивное звено кольца:
+// единственное с count == 0, оно и есть end().
+template <typename Tag = default_tag>
+struct btree_link {
+  btree_link* prev{this};
+  btree_link* next{this};
+  std::uint16_t count{0};
+};
+
+// Индекс на B+-дереве: ключи лежат не в узлах, а в широких листах из
+// нескольких кеш-линий, так что поиск читает O(log_B n) линий вместо O(log_2 n).
+// В узле пары остается только указатель на лист с ее записью.
+// Ключи должны копироваться (разделители -- копии ключей) и перемещаться
+// без исключений (записи сдвигаются внутри листа).
+template <typename K, typename Comp = std::less<K>, typename Tag = default_tag>
+struct btree : private Comp, btree_link<Tag> {
+
+  using key_type = K;
+  using tag_type = Tag;
+  using link_t = btree_link<Tag>;
+
+  static constexpr bool key_in_node = false;
+
+  // ~8 кеш-линий на лист: ключи и указатели на узлы в разных массивах,
+  // поэтому двоичный поиск читает только линии ключей
+  static constexpr std::size_t CAPACITY =
+      std::max<std::size_t>(4, 512 / (sizeof(K) + sizeof(void*)));
+
+  struct leaf_t;
+  struct inner_t;
+
+  struct node_t {
+    explicit node_t(no_key) noexcept {}
+
+    node_t(const node_t&) = delete;
+
+    node_t(node_t&& other) noexcept : leaf(other.leaf) {}
+
+    node_t& operator=(const node_t&) = delete;
+
+  private:
+    friend btree;
+
+    leaf_t* leaf{nullptr};
+  };
+
+  struct base_t {
+    inner_t* parent{nullptr};
+  };
+
+  struct leaf_t : link_t, base_t {
+    K& key(std::size_t i) noexcept {
+      return *std::launder(reinterpret_cast<K*>(keys) + i);
+    }
+
+    node_t* nodes[CAPACITY];
+    alignas(K) unsigned char keys[CAPACITY * sizeof(K)];
+  };
+
+  struct inner_t : base_t {
+    // все ключи children[i] < sep(i) <= все ключи children[i + 1]
+    K& sep(std::size_t i) noexcept {
+      return *std::launder(reinterpret_cast<K*>(seps) + i);
+    }
+
+    std::uint16_t count{0};
+    bool leaf_children{false};
+    base_t* children[CAPACITY];
+    alignas(K) unsigned char seps[(CAPACITY - 1) * sizeof(K)];
+  };
+
+  // Итератор хранит узел пары, а место в листе находит через node->leaf:
+  // вставки и удаления других пар сдвигают записи листа, но не узлы.
+  // slot -- последнее известное место, проверяется перед использованием
+  struct iterator {
+
+    friend btree;
+
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::remove_const_t<K>;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() noexcept = default;
+
+    iterator& operator++() noexcept {
+      leaf_t* leaf = locate();
+      if (slot + 1 < leaf->count) {
+        node = leaf->nodes[++slot];
+      } else {
+        enter(leaf->next, 0);
+      }
+      return *this;
+    }
+
+    iterator operator++(int) noexcept {
+      iterator copy = *this;
+      operator++();
+      return copy;
+    }
+
+    iterator& operator--() noexcept {
+      if (!node) {
+        enter(ring->prev, ring->prev->count - 1);
+        return *this;
+      }
+      leaf_t* leaf = locate();
+      if (slot > 0) {
+        node = leaf->nodes[--slot];
+      } else {
+        enter(leaf->prev, leaf->prev->count - 1);
+      }
+      return *this;
+    }
+
+    iterator operator--(int) noexcept {
+      iterator copy = *this;
+      operator--();
+      return copy;
+    }
+
+    const K* operator->() const noexcept {
+      return &operator*();
+    }
+
+    const K& operator*() const noexcept {
+      return locate()->key(slot);
+    }
+
+    bool operator==(iterator const& other) const noexcept {
+      return node == other.node && (node || ring == other.ring);
+    }
+
+    bool operator!=(iterator const& other) const noexcept {
+      return !(*this == other);
+    }
+
+    node_t* get_node() const noexcept {
+      return node;
+    }
+
+  private:
+    // end(): кольцо листьев, пар нет
+    explicit iterator(const link_t* ring) noexcept
+        : ring(const_cast<link_t*>(ring)) {}
+
+    iterator(const link_t* link, std::size_t slot) noexcept {
+      enter(const_cast<link_t*>(link), slot);
+    }
+
+    void enter(link_t* link, std::size_t slot) noexcept {
+      if (link->count == 0) {
+        node = nullptr;
+        ring = link;
+        this->slot = 0;
+      } else {
+        node = static_cast<leaf_t*>(link)->nodes[slot];
+        this->slot = slot;
+      }
+    }
+
+    leaf_t* locate() const noexcept {
+      leaf_t* leaf = node->leaf;
+      if (slot >= leaf->count || leaf->nodes[slot] != node) {
+        slot = std::find(leaf->nodes, leaf->nodes + leaf->count, node) - leaf->nodes;
+      }
+      return leaf;
+    }
+
+    node_t* node{nullptr};
+    link_t* ring{nullptr};
+    mutable std::size_t slot{0};
+  };
+
+  using const_iterator = iterator;
+
+  btree(Comp&& comp) noexcept : Comp(std::move(comp)) {}
+
+  btree(const btree&) = delete;
+
+  btree(btree&& other) noexcept : Comp(static_cast<Comp&>(other)) {
+    swap(other);
+  }
+
+  btree& operator=(const btree&) = delete;
+
+  btree& operator=(btree&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+    }
+    return *this;
+  }
+
+  ~btree() {
+    destroy(root);
+  }
+
+  void swap(btree& other) noexcept {
+    link_t* first = root ? link_t::next : nullptr;
+    link_t* last = root ? link_t::prev : nullptr;
+    link_t* other_first = other.root ? other.link_t::next : nullptr;
+    link_t* other_last = other.root ? other.link_t::prev : nullptr;
+    std::swap(static_cast<Comp&>(*this), static_cast<Comp&>(other));
+    std::swap(root, other.root);
+    std::swap(height, other.height);
+    attach_ring(other_first, other_last);
+    other.attach_ring(first, last);
+  }
+
+  const Comp& get_comparator() const noexcept {
+    return static_cast<const Comp&>(*this);
+  }
+
+  // у end() нет узла, вместо него -- само дерево
+  static const btree* end_owner(const iterator& it) noexcept {
+    return it.node ? nullptr : static_cast<const btree*>(it.ring);
+  }
+
+  static iterator iterator_to(const node_t* node) noexcept {
+    leaf_t* leaf = node->leaf;
+    return iterator(leaf, std::find(leaf->nodes, leaf->nodes + leaf->count, node) -
+                              leaf->nodes);
+  }
+
+  // `fresh` перемещен из `old` и занимает его место в дереве
+  static void replace(node_t* old, node_t* fresh) noexcept {
+    leaf_t* leaf = fresh->leaf;
+    *std::find(leaf->nodes, leaf->nodes + leaf->count, old) = fresh;
+  }
+
+  static const K& key_of(const node_t* node) noexcept {
+    return *iterator_to(node);
+  }
+
+  // Вызывает f(узел, ключ, следующий узел или nullptr) для ключей из [lo, hi)
+  // по порядку, пока f возвращает true. Входя в лист, подгружает в кеш
+  // следующий; "следующий узел" -- на несколько записей впереди текущего.
+  template <typename F>
+  void scan(const K& lo, const K& hi, F&& f) const {
+    constexpr std::size_t AHEAD = 4;
+    iterator start = lower_bound(lo);
+    if (!start.node) {
+      return;
+    }
+    std::size_t slot = start.slot;
+    for (link_t* link = start.locate(); link != this; link = link->next, slot = 0) {
+      prefetch(link->next, sizeof(leaf_t));
+      auto* leaf = static_cast<leaf_t*>(link);
+      for (; slot < leaf->count; ++slot) {
+        if (!compare(leaf->key(slot), hi)) {
+          return;
+        }
+        node_t* ahead = slot + AHEAD < leaf->count ? leaf->nodes[slot + AHEAD] : nullptr;
+        if (!f(leaf->nodes[slot], leaf->key(slot), ahead)) {
+          return;
+        }
+      }
+    }
+  }
+
+  void memory_usage(memory_stats& stats) const noexcept {
+    for (auto* link = link_t::next; link != this; link = link->next) {
+      auto* leaf = static_cast<leaf_t*>(link);
+      for (std::size_t i = 0; i < leaf->count; ++i) {
+        stats.keys += key_heap_usage(leaf->key(i));
+      }
+    }
+    add_memory_usage(stats, root);
+  }
+
+  iterator find(const K& key) const noexcept {
+    iterator it = lower_bound(key);
+    if (it != end() && !compare(key, *it)) {
+      return it;
+    }
+    return end();
+  }
+
+  iterator lower_bound(const K& key) const noexcept {
+    if (!root) {
+      return end();
+    }
+    leaf_t* leaf = find_leaf(key);
+    K* first = &leaf->key(0);
+    return normalize(leaf, std::lower_bound(first, first + leaf->count, key,
+                                            get_comparator()) - first);
+  }
+
+  iterator upper_bound(const K& key) const noexcept {
+    if (!root) {
+      return end();
+    }
+    leaf_t* leaf = find_leaf(key);
+    K* first = &leaf->key(0);
+    return normalize(leaf, std::upper_bound(first, first + leaf->count, key,
+                                            get_comparator()) - first);
+  }
+
+  template <typename KK>
+  iterator insert(node_t* node, KK&& new_key) {
+    const K& key = new_key;
+    if (!root) {
+      leaf_t* leaf = new leaf_t();
+      link_after(this, leaf);
+      root = leaf;
+    }
+    leaf_t* leaf = find_leaf(key);
+    if (leaf->count == CAPACITY) {
+      leaf_t* right = split_leaf(leaf);
+      if (!compare(key, right->key(0))) {
+        leaf = right;
+      }
+    }
+    K* first = &leaf->key(0);
+    std::size_t pos = std::upper_bound(first, first + leaf->count, key,
+                                       get_comparator()) - first;
+    new (&leaf->key(leaf->count)) K(std::forward<KK>(new_key));
+    std::rotate(first + pos, first + leaf->count, first + leaf->count + 1);
+    std::move_backward(leaf->nodes + pos, leaf->nodes + leaf->count,
+                       leaf->nodes + leaf->count + 1);
+    leaf->nodes[pos] = node;
+    ++leaf->count;
+    node->leaf = leaf;
+    return iterator(leaf, pos);
+  }
+
+  iterator erase(const iterator& it) noexcept {
+    iterator next = it;
+    ++next;
+
+    leaf_t* leaf = it.locate();
+    K* first = &leaf->key(0);
+    std::move(first + it.slot + 1, first + leaf->count, first + it.slot);
+    std::move(leaf->nodes + it.slot + 1, leaf->nodes + leaf->count,
+              leaf->nodes + it.slot);
+    --leaf->count;
+    leaf->key(leaf->count).~K();
+    rebalance_leaf(leaf);
+    return next;
+  }
+
+  iterator begin() const noexcept {
+    return iterator(link_t::next, 0);
+  }
+
+  iterator end() const noexcept {
+    return iterator(static_cast<const link_t*>(this));
+  }
+
+private:
+  bool compare(const K& k1, const K& k2) const noexcept {
+    return get_comparator()(k1, k2);
+  }
+
+  iterator normalize(leaf_t* leaf, std::size_t slot) const noexcept {
+    if (slot == leaf->count) {
+      return iterator(leaf->next, 0);
+    }
+    return iterator(leaf, slot);
+  }
+
+  leaf_t* find_leaf(const K& key) const noexcept {
+    if (root_is_leaf()) {
+      return static_cast<leaf_t*>(root);
+    }
+    auto* inner = static_cast<inner_t*>(root);
+    while (true) {
+      K* first = &inner->sep(0);
+      std::size_t i = std::upper_bound(first, first + inner->count - 1, key,
+                                       get_comparator()) - first;
+      if (inner->leaf_children) {
+        return static_cast<leaf_t*>(inner->children[i]);
+      }
+      inner = static_cast<inner_t*>(inner->children[i]);
+    }
+  }
+
+  bool root_is_leaf() const noexcept {
+    return height == 0;
+  }
+
+  void attach_ring(link_t* first, link_t* last) noexcept {
+    if (!first) {
+      link_t::prev = link_t::next = this;
+      return;
+    }
+    link_t::next = first;
+    link_t::prev = last;
+    first->prev = this;
+    last->next = this;
+  }
+
+  static void link_after(link_t* pos, link_t* link) noexcept {
+    link->prev = pos;
+    link->next = pos->next;
+    pos->next->prev = link;
+    pos->next = link;
+  }
+
+  static void unlink(link_t* link) noexcept {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+  }
+
+  static std::size_t index_in_parent(const base_t* child) noexcept {
+    inner_t* parent = child->parent;
+    return std::find(parent->children, parent->children + parent->count, child) -
+           parent->children;
+  }
+
+  leaf_t* split_leaf(leaf_t* leaf) {
+    leaf_t* right = new leaf_t();
+    std::size_t mid = leaf->count / 2;
+    std::size_t moved = leaf->count - mid;
+    try {
+      insert_child(leaf, leaf->key(mid), right);
+    } catch (...) {
+      delete right;
+      throw;
+    }
+    for (std::size_t i = 0; i < moved; ++i) {
+      new (&right->key(i)) K(std::move(leaf->key(mid + i)));
+      leaf->key(mid + i).~K();
+      right->nodes[i] = leaf->nodes[mid + i];
+      right->nodes[i]->leaf = right;
+    }
+    right->count = moved;
+    leaf->count = mid;
+    link_after(leaf, right);
+    return right;
+  }
+
+  // вставляет `right` (с разделителем `sep`) в родителя сразу после `left`;
+  // если `left` -- корень, дерево растет
+  void insert_child(base_t* left, const K& sep, base_t* right) {
+    if (left == root) {
+      auto* new_root = new inner_t();
+      try {
+        new (&new_root->sep(0)) K(sep);
+      } catch (...) {
+        delete new_root;
+        throw;
+      }
+      new_root->leaf_children = root_is_leaf();
+      new_root->children[0] = left;
+      new_root->children[1] = right;
+      new_root->count = 2;
+      left->parent = right->parent = new_root;
+      root = new_root;
+      ++height;
+      return;
+    }
+    inner_t* parent = left->parent;
+    std::size_t pos = index_in_parent(left) + 1;
+    if (parent->count == CAPACITY) {
+      inner_t* sibling = split_inner(parent);
+      if (pos > parent->count) {
+        pos -= parent->count;
+        parent = sibling;
+      }
+    }
+    K* first = &parent->sep(0);
+    std::size_t seps = parent->count - 1;
+    new (&parent->sep(seps)) K(sep);
+    std::rotate(first + pos - 1, first + seps, first + seps + 1);
+    std::move_backward(parent->children + pos, parent->children + parent->count,
+                       parent->children + parent->count + 1);
+    parent->children[pos] = right;
+    right->parent = parent;
+    ++parent->count;
+  }
+
+  inner_t* split_inner(inner_t* inner) {
+    auto* right = new inner_t();
+    right->leaf_children = inner->leaf_children;
+    std::size_t mid = inner->count / 2;
+    try {
+      insert_child(inner, inner->sep(mid - 1), right);
+    } catch (...) {
+      delete right;
+      throw;
+    }
+    for (std::size_t i = mid; i < inner->count; ++i) {
+      right->children[i - mid] = inner->children[i];
+      right->children[i - mid]->parent = right;
+    }
+    for (std::size_t i = mid; i + 1 < inner->count; ++i) {
+      new (&right->sep(i - mid)) K(std::move(inner->sep(i)));
+    }
+    for (std::size_t i = mid - 1; i + 1 < inner->count; ++i) {
+      inner->sep(i).~K();
+    }
+    right->count = inner->count - mid;
+    inner->count = mid;
+    return right;
+  }
+
+  // лист меньше четверти вместимости сливается с соседом, пустой
+  // удаляется из кольца
+  void rebalance_leaf(leaf_t* leaf) noexcept {
+    if (leaf->count == 0) {
+      unlink(leaf);
+      remove_node(leaf);
+      return;
+    }
+    if (leaf == root || leaf->count >= CAPACITY / 4) {
+      return;
+    }
+    inner_t* parent = leaf->parent;
+    if (parent->count < 2) {
+      return;
+    }
+    std::size_t i = index_in_parent(leaf);
+    auto* left = static_cast<leaf_t*>(i > 0 ? parent->children[i - 1] : leaf);
+    auto* right = static_cast<leaf_t*>(i > 0 ? leaf : parent->children[i + 1]);
+    if (left->count + right->count > CAPACITY * 3 / 4) {
+      return;
+    }
+    for (std::size_t j = 0; j < right->count; ++j) {
+      new (&left->key(left->count + j)) K(std::move(right->key(j)));
+      right->key(j).~K();
+      left->nodes[left->count + j] = right->nodes[j];
+      left->nodes[left->count + j]->leaf = left;
+    }
+    left->count += right->count;
+    right->count = 0;
+    unlink(right);
+    remove_node(right);
+  }
+
+  void rebalance_inner(inner_t* inner) noexcept {
+    if (inner == root) {
+      while (!root_is_leaf() && static_cast<inner_t*>(root)->count == 1) {
+        auto* old_root = static_cast<inner_t*>(root);
+        root = old_root->children[0];
+        root->parent = nullptr;
+        delete old_root;
+        --height;
+      }
+      return;
+    }
+    if (inner->count >= CAPACITY / 4) {
+      return;
+    }
+    inner_t* parent = inner->parent;
+    if (parent->count < 2) {
+      return;
+    }
+    std::size_t i = index_in_parent(inner);
+    auto* left = static_cast<inner_t*>(i > 0 ? parent->children[i - 1] : inner);
+    auto* right = static_cast<inner_t*>(i > 0 ? inner : parent->children[i + 1]);
+    if (left->count + right->count > CAPACITY) {
+      return;
+    }
+    std::size_t sep_index = i > 0 ? i - 1 : 0;
+    new (&left->sep(left->count - 1)) K(std::move(parent->sep(sep_index)));
+    for (std::size_t j = 0; j < right->count; ++j) {
+      left->children[left->count + j] = right->children[j];
+      left->children[left->count + j]->parent = left;
+    }
+    for (std::size_t j = 0; j + 1 < right->count; ++j) {
+      new (&left->sep(left->count + j)) K(std::move(right->sep(j)));
+      right->sep(j).~K();
+    }
+    left->count += right->count;
+    right->count = 0;
+    remove_node(right);
+  }
+
+  // удаляет опустевший узел из родителя и освобождает его
+  void remove_node(base_t* node) noexcept {
+    if (node == root) {
+      delete static_cast<leaf_t*>(node);
+      root = nullptr;
+      return;
+    }
+    inner_t* parent = node->parent;
+    std::size_t i = index_in_parent(node);
+    std::size_t sep = i > 0 ? i - 1 : 0;
+    if (parent->leaf_children) {
+      delete static_cast<leaf_t*>(node);
+    } else {
+      delete static_cast<inner_t*>(node);
+    }
+    K* first = &parent->sep(0);
+    std::size_t seps = parent->count - 1;
+    if (seps > 0) {
+      std::move(first + sep + 1, first + seps, first + sep);
+      parent->sep(seps - 1).~K();
+    }
+    std::move(parent->children + i + 1, parent->children + parent->count,
+              parent->children + i);
+    if (--parent->count == 0) {
+      remove_node(parent);
+    } else {
+      rebalance_inner(parent);
+    }
+  }
+
+  // пустые места в узлах считаются накладными расходами
+  void add_memory_usage(memory_stats& stats, const base_t* node,
+                        std::size_t level = 0) const noexcept {
+    if (!node) {
+      return;
+    }
+    std::size_t count;
+    std::size_t size;
+    const void* block;
+    if (level == height) {
+      auto* leaf = static_cast<const leaf_t*>(node);
+      count = leaf->count;
+      size = sizeof(leaf_t);
+      block = leaf;
+    } else {
+      auto* inner = static_cast<const inner_t*>(node);
+      for (std::size_t i = 0; i < inner->count; ++i) {
+        add_memory_usage(stats, inner->children[i], level + 1);
+      }
+      count = inner->count;
+      size = sizeof(inner_t);
+      block = inner;
+    }
+    std::size_t unused = (CAPACITY - count) * (sizeof(K) + sizeof(void*));
+    stats.index += size - unused;
+    stats.slack += unused + allocation_slack(block, size);
+  }
+
+  void destroy(base_t* node, std::size_t level = 0) noexcept {
+    if (!node) {
+      return;
+    }
+    if (level == height) {
+      auto* leaf = static_cast<leaf_t*>(node);
+      for (std::size_t i = 0; i < leaf->count; ++i) {
+        leaf->key(i).~K();
+      }
+      delete leaf;
+      return;
+    }
+    auto* inner = static_cast<inner_t*>(node);
+    for (std::size_t i = 0; i < inner->count; ++i) {
+      destroy(inner->children[i], level + 1);
+    }
+    for (std::size_t i = 0; i + 1 < inner->count; ++i) {
+      inner->sep(i).~K();
+    }
+    delete inner;
+  }
+
+  base_t* root{nullptr};
+  std::size_t height{0};
+};
+
+} // namespace intrusive
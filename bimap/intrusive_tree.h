@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <random>
 
+#include "key_storage.h"
+#include "memory_stats.h"
+
 namespace intrusive {
 
 struct tree_element_base {
@@ -30,13 +33,28 @@ struct tree_element_base {
 
 struct default_tag;
 
+// Передается в узел индекса, который хранит ключи вне узлов.
+struct no_key {};
+
 template <typename Tag = default_tag>
 struct tree_element : tree_element_base {};
 
 inline thread_local std::mt19937_64 random_generator{std::random_device()()};
 
-template <typename K, typename Tag = default_tag>
-struct node : tree_element<Tag> {
+// Подсказка кешу: скоро будут читаться `size` байт по адресу `ptr`.
+inline void prefetch(const void* ptr, std::size_t size = 1) noexcept {
+#if defined(__GNUC__)
+  for (std::size_t offset = 0; offset < size; offset += 64) {
+    __builtin_prefetch(static_cast<const char*>(ptr) + offset);
+  }
+#else
+  (void)ptr;
+  (void)size;
+#endif
+}
+
+template <typename K, typename Tag = default_tag, typename Storage = plain_key>
+struct node : tree_element<Tag>, Storage {
   K key;
   uint64_t priority;
 
@@ -46,11 +64,13 @@ struct node : tree_element<Tag> {
   explicit node(const K &key) noexcept
       : key(key), priority(random_generator()) {}
 
-  node(const node& other) noexcept : key(other.key), priority(other.priority) {}
+  node(const node& other) noexcept
+      : Storage(static_cast<const Storage&>(other)), key(other.key), priority(other.priority) {}
 
   node(node&& other) noexcept
-      : key(std::move(other.key)), priority(other.priority),
-        tree_element_base(static_cast<tree_element_base&&>(std::move(other))) {}
+      : tree_element<Tag>(static_cast<tree_element<Tag>&&>(other)),
+        Storage(static_cast<const Storage&>(other)),
+        key(std::move(other.key)), priority(other.priority) {}
 
   node& operator=(const node&) = delete;
 
@@ -64,28 +84,35 @@ struct node : tree_element<Tag> {
   }
 };
 
-template <typename K, typename Tag = default_tag>
-node<K, Tag>& from_base(tree_element_base& base) noexcept {
-  return static_cast<node<K, Tag>&>(base);
+template <typename K, typename Tag = default_tag, typename Storage = plain_key>
+node<K, Tag, Storage>& from_base(tree_element_base& base) noexcept {
+  return static_cast<node<K, Tag, Storage>&>(base);
 }
 
-template <typename K, typename Tag = default_tag>
-tree_element_base& to_base(node<K, Tag>& node) noexcept {
+template <typename K, typename Tag = default_tag, typename Storage = plain_key>
+tree_element_base& to_base(node<K, Tag, Storage>& node) noexcept {
   return static_cast<tree_element_base&>(node);
 }
 
 template <typename K, typename Comp = std::less<K>, typename Tag = default_tag>
 struct intrusive_tree : private Comp, tree_element<Tag> {
 
-  using node_t = node<K, Tag>;
+  using storage_t = typename key_storage<K, Comp>::type;
+  using context_t = typename storage_t::context;
+  using node_t = node<K, Tag, storage_t>;
   using elem_t = tree_element<Tag>;
+  using key_type = K;
+  using tag_type = Tag;
+
+  static constexpr bool key_in_node = true;
 
   intrusive_tree(Comp &&comp) noexcept : Comp(std::move(comp)) {}
 
   intrusive_tree(const intrusive_tree&) = delete;
 
   intrusive_tree(intrusive_tree&& other) noexcept
-      : Comp(std::move(other)), elem_t(std::move(other.to_root())) {
+      : Comp(std::move(other)), elem_t(std::move(other.to_root())),
+        context(other.context) {
     auto *root_base = &static_cast<tree_element_base&>(to_root());
     update_parent(root_base->left, root_base);
     other.clear();
@@ -96,7 +123,9 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
   intrusive_tree& operator=(intrusive_tree&& other) noexcept {
     if (this != &other) {
       to_root() = std::move(other.to_root());
+      update_parent(to_root().left, &to_root());
       static_cast<Comp&>(*this) = std::move(static_cast<Comp&>(other));
+      context = other.context;
     }
     return *this;
   }
@@ -130,17 +159,7 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
         : data(other.data) {}
 
     tree_iterator& operator++() noexcept {
-      if (data->right) {
-        data = data->right;
-        while (data->left) {
-          data = data->left;
-        }
-      } else {
-        while (data->parent && data->parent->right == data) {
-          data = data->parent;
-        }
-        data = data->parent;
-      }
+      data = successor(data);
       return *this;
     }
 
@@ -188,7 +207,7 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
     }
 
     node_t* get_node() const noexcept {
-      return &const_cast<node_t&>(from_base<K, Tag>(*data));
+      return &const_cast<node_t&>(from_base<K, Tag, storage_t>(*data));
     }
 
     elem_t* get_elem() const noexcept {
@@ -209,20 +228,83 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
   using iterator = tree_iterator<K>;
   using const_iterator = tree_iterator<const K>;
 
+  // фиктивный корень -- это end(), единственный узел без родителя
+  static const intrusive_tree* end_owner(const iterator& it) noexcept {
+    return it.get_base()->parent == nullptr
+               ? static_cast<const intrusive_tree*>(it.get_elem())
+               : nullptr;
+  }
+
+  static iterator iterator_to(node_t* node) noexcept {
+    return iterator(node);
+  }
+
+  // `fresh` перемещен из `old` и занимает его место в дереве
+  static void replace(node_t* old, node_t* fresh) noexcept {
+    tree_element_base* base = &to_base(*fresh);
+    update_parent(base->left, base);
+    update_parent(base->right, base);
+    if (base->parent->left == &to_base(*old)) {
+      base->parent->left = base;
+    } else {
+      base->parent->right = base;
+    }
+  }
+
+  static const K& key_of(const node_t* node) noexcept {
+    return node->key;
+  }
+
+  // Вызывает f(узел, ключ, следующий узел или nullptr) для ключей из [lo, hi)
+  // по порядку, пока f возвращает true. Поиск следующего узла и так читает
+  // его, поэтому в кеш заранее подгружается только начало спуска после него.
+  template <typename F>
+  void scan(const K& lo, const K& hi, F&& f) const {
+    probe_t upper(hi, context);
+    const tree_element_base* last = &to_root();
+    tree_element_base* curr = lower_bound(to_root().left, probe_t(lo, context)).get_base();
+    while (curr != last && compare(probe(curr), upper)) {
+      tree_element_base* next = successor(curr);
+      if (next->right) {
+        // отсюда начнется спуск к узлу после `next`
+        prefetch(next->right);
+      }
+      node_t* node = node_t_from_base(curr);
+      if (!f(node, node->key, nullptr)) {
+        return;
+      }
+      curr = next;
+    }
+  }
+
+  // декартово дерево целиком в узлах, память вне них бывает только у ключей
+  void memory_usage(memory_stats& stats) const noexcept {
+    for (auto it = begin(); it != end(); ++it) {
+      stats.keys += key_heap_usage(*it);
+    }
+  }
+
   iterator find(const K& key) const noexcept {
-    return find(to_root().left, key);
+    return find(to_root().left, probe_t(key, context));
   }
 
+  // данные политики в узле заполняет дерево, до вставки они пустые
   iterator insert(node_t* node) noexcept {
+    if (context.update(node->key, !to_root().left)) {
+      for (auto it = begin(); it != end(); ++it) {
+        store(it.get_node());
+      }
+    }
+    store(node);
     to_root().left = insert(to_root().left, node);
     update_parent(to_root().left, &to_root());
     return iterator(node);
   }
 
   iterator erase(const iterator& it) noexcept {
-    to_root().left = erase(to_root().left, get_key(it.data));
+    to_root().left = erase(to_root().left, probe(it.data));
     update_parent(to_root().left, &to_root());
-    return lower_bound(to_root().left, get_key(it.data));
+    return lower_bound(to_root().left, probe(it.data));
   }
 
   const tree_element_base* least_element() const noexcept {
@@ -237,11 +319,11 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
   }
 
   iterator lower_bound(const K& key) const noexcept {
-    return lower_bound(to_root().left, key);
+    return lower_bound(to_root().left, probe_t(key, context));
   }
 
   iterator upper_bound(const K& key) const noexcept {
-    return upper_bound(to_root().left, key);
+    return upper_bound(to_root().left, probe_t(key, context));
   }
 
   iterator begin() noexcept {
@@ -262,12 +344,40 @@ struct intrusive_tree : private Comp, tree_element<Tag> {
 
 private:
 
-  bool compare(const K& k1, const K& k2) const noexcept {
-    return get_comparator()(k1, k2);
+  // ключ вместе с данными политики; для узла они берутся из узла
+  struct probe_t {
+    probe_t(const K& key, const context_t& context) noexcept
+        : inline_data(key, context), key(key) {}
+
+    probe_t(const storage_t& inline_data, const K& key) noexcept
+        : inline_data(inline_data), key(key) {}
+
+    storage_t inline_data;
+    const K& key;
+  };
+
+  void store(node_t* node) const noexcept {
+    static_cast<storage_t&>(*node) = storage_t(node->key, context);
   }
 
-  bool equals(const K& k1, const K& k2) const noexcept {
-    return !compare(k1, k2) && !compare(k2, k1);
+  probe_t probe(tree_element_base* base) const noexcept {
+    node_t* node = node_t_from_base(base);
+    return probe_t(static_cast<const storage_t&>(*node), node->key);
+  }
+
+  bool compare(const probe_t& k1, const probe_t& k2) const noexcept {
+    int inline_order = storage_t::compare_inline(k1.inline_data, k2.inline_data);
+    if (inline_order != 0) {
+      return inline_order < 0;
+    }
+    return get_comparator()(k1.key, k2.key);
+  }
+
+  bool equals(const probe_t& k1, const probe_t& k2) const noexcept {
+    if (storage_t::compare_inline(k1.inline_data, k2.inline_data) != 0) {
+      return false;
+    }
+    return !get_comparator()(k1.key, k2.key) && !get_comparator()(k2.key, k1.key);
   }
 
   void clear() {
@@ -282,26 +392,37 @@ private:
 
   node_t* node_t_from_base(tree_element_base* base) const noexcept {
     return &const_cast<node_t&>(
-        static_cast<const node_t&>(from_base<K, Tag>(*base)));
+        static_cast<const node_t&>(from_base<K, Tag, storage_t>(*base)));
   }
 
-  const K& get_key(tree_element_base* base) const noexcept {
-    return node_t_from_base(base)->key;
+  static tree_element_base* successor(tree_element_base* data) noexcept {
+    if (data->right) {
+      data = data->right;
+      while (data->left) {
+        data = data->left;
+      }
+    } else {
+      while (data->parent && data->parent->right == data) {
+        data = data->parent;
+      }
+      data = data->parent;
+    }
+    return data;
   }
 
-  void update_parent(tree_element_base* child,
-                     tree_element_base* parent) noexcept {
+  static void update_parent(tree_element_base* child,
+                            tree_element_base* parent) noexcept {
     if (child) {
       child->parent = parent;
     }
   }
 
   std::pair<tree_element_base*, tree_element_base*>
-  split(tree_element_base* curr, const K& key) noexcept {
+  split(tree_element_base* curr, const probe_t& key) noexcept {
     if (!curr) {
       return {nullptr, nullptr};
     }
-    if (compare(get_key(curr), key)) {
+    if (compare(probe(curr), key)) {
       std::pair<tree_element_base*, tree_element_base*> res =
           split(curr->right, key);
       curr->right = res.first;
@@ -337,14 +458,14 @@ private:
     }
   }
 
-  iterator find(tree_element_base* curr, const K& key) const noexcept {
+  iterator find(tree_element_base* curr, const probe_t& key) const noexcept {
     if (!curr) {
       return end();
     }
-    if (equals(get_key(curr), key)) {
+    if (equals(probe(curr), key)) {
       return iterator(curr);
     }
-    if (compare(key, get_key(curr))) {
+    if (compare(key, probe(curr))) {
       return find(curr->left, key);
     }
     return find(curr->right, key);
@@ -359,14 +480,14 @@ private:
       return curr;
     }
     if (get_priority(v) < get_priority(curr)) {
-      auto p = split(curr, get_key(v));
+      auto p = split(curr, probe(v));
       v->left = p.first;
       v->right = p.second;
       update_parent(p.first, v);
       update_parent(p.second, v);
       return v;
     }
-    if (compare(get_key(v), get_key(curr))) {
+    if (compare(probe(v), probe(curr))) {
       curr->left = insert(curr->left, v);
       update_parent(curr->left, curr);
     } else {
@@ -376,17 +497,17 @@ private:
     return curr;
   }
 
-  tree_element_base* erase(tree_element_base* curr, const K& key) noexcept {
+  tree_element_base* erase(tree_element_base* curr, const probe_t& key) noexcept {
     if (!curr) {
       return nullptr;
     }
-    if (equals(get_key(curr), key)) {
+    if (equals(probe(curr), key)) {
       auto par = curr->parent;
       auto res = merge(curr->left, curr->right);
       update_parent(res, par);
       return res;
     }
-    if (compare(key, get_key(curr))) {
+    if (compare(key, probe(curr))) {
       curr->left = erase(curr->left, key);
       update_parent(curr->left, curr);
     } else {
@@ -396,7 +517,7 @@ private:
     return curr;
   }
 
-  iterator find_bound(tree_element_base* curr, const K& key,
+  iterator find_bound(tree_element_base* curr, const probe_t& key,
                        tree_element_base* best, bool strict_bound) const noexcept {
     if (!curr && best) {
       return iterator(best);
@@ -404,21 +525,21 @@ private:
     if (!curr) {
       return iterator(end());
     }
-    if ((compare(key, get_key(curr)) && !curr->left) ||
-        (!strict_bound && equals(key, get_key(curr)))) {
+    if ((compare(key, probe(curr)) && !curr->left) ||
+        (!strict_bound && equals(key, probe(curr)))) {
       return iterator(curr);
     }
-    if (compare(key, get_key(curr))) {
+    if (compare(key, probe(curr))) {
       return find_bound(curr->left, key, curr, strict_bound);
     }
     return find_bound(curr->right, key, best, strict_bound);
   }
 
-  iterator lower_bound(tree_element_base* curr, const K& key) const noexcept {
+  iterator lower_bound(tree_element_base* curr, const probe_t& key) const noexcept {
       return find_bound(curr, key, nullptr, false);
   }
 
-  iterator upper_bound(tree_element_base* curr, const K& key) const noexcept {
+  iterator upper_bound(tree_element_base* curr, const probe_t& key) const noexcept {
     return find_bound(curr, key, nullptr, true);
   }
 
@@ -431,6 +552,8 @@ private:
   }
 
   // base node_t is a fake node, her .left is real root
+
+  context_t context;
 };
 
 } // namespace intrusive
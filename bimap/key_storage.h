@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace intrusive {
+
+// Политики хранения ключа в узлах intrusive_tree: что лежит в узле рядом с
+// ключом, чтобы большинство сравнений решалось без обращения к самому ключу.
+// compare_inline возвращает < 0 или > 0, если порядок ясен по данным в узле,
+// и 0, если нужно сравнивать сами ключи.
+//
+// Данные узла считаются относительно общего для дерева состояния `context`.
+// Дерево передает в context::update каждый вставляемый ключ (first -- дерево
+// пусто) и, если update вернул true, пересчитывает данные во всех узлах.
+
+struct plain_key {
+  struct context {
+    template <typename K>
+    static bool update(const K&, bool) noexcept {
+      return false;
+    }
+  };
+
+  plain_key() noexcept = default;
+
+  template <typename K>
+  plain_key(const K&, const context&) noexcept {}
+
+  static int compare_inline(const plain_key&, const plain_key&) noexcept {
+    return 0;
+  }
+};
+
+// 8 байт строки после общего начала всех ключей дерева, старшие первыми и
+// дополненные нулями: если у двух ключей они различаются, их порядок как чисел
+// совпадает с лексикографическим. У URL одного сайта начало одинаковое, и
+// первые 8 байт строки ничего бы не решали. Ключ поиска не с общего начала
+// сравнивается целиком.
+struct string_prefix {
+  // Общее начало ключей, не длиннее max_common байт. Оно только укорачивается,
+  // поэтому узлы пересчитываются не больше max_common + 1 раз, пока дерево не
+  // опустеет.
+  struct context {
+    static constexpr std::size_t max_common = 64;
+
+    bool update(const std::string& key, bool first) noexcept {
+      if (first) {
+        length = std::min(key.size(), max_common);
+        std::copy_n(key.data(), length, common);
+        return true;
+      }
+      std::size_t n = std::min(key.size(), length);
+      std::size_t same = std::mismatch(common, common + n, key.data()).first - common;
+      if (same == length) {
+        return false;
+      }
+      length = same;
+      return true;
+    }
+
+    char common[max_common];
+    std::size_t length{0};
+  };
+
+  string_prefix() noexcept = default;
+
+  string_prefix(const std::string& key, const context& ctx) noexcept {
+    if (key.compare(0, ctx.length, ctx.common, ctx.length) != 0) {
+      return;
+    }
+    shared = true;
+    std::size_t n = std::min<std::size_t>(key.size() - ctx.length, sizeof(prefix));
+    for (std::size_t i = 0; i < n; ++i) {
+      prefix |= std::uint64_t(static_cast<unsigned char>(key[ctx.length + i]))
+                << (56 - 8 * i);
+    }
+  }
+
+  static int compare_inline(const string_prefix& a,
+                            const string_prefix& b) noexcept {
+    if (!a.shared || !b.shared) {
+      return 0;
+    }
+    return a.prefix < b.prefix ? -1 : a.prefix > b.prefix;
+  }
+
+  std::uint64_t prefix{0};
+  // ключ начинается с общего начала, prefix взят после него
+  bool shared{false};
+};
+
+// Политика хранения для типа ключа и компаратора. Для своих типов ее можно
+// специализировать, она должна быть согласована с компаратором.
+template <typename K, typename Comp>
+struct key_storage {
+  using type = plain_key;
+};
+
+template <>
+struct key_storage<std::string, std::less<std::string>> {
+  using type = string_prefix;
+};
+
+template <>
+struct key_storage<std::string, std::less<>> {
+  using type = string_prefix;
+};
+
+} // namespace intrusive
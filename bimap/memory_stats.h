@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace intrusive {
+
+struct memory_stats {
+  std::size_t nodes{0};  // узлы пар вместе с ключами, лежащими в них
+  std::size_t keys{0};   // память в куче, принадлежащая ключам, см. heap_usage
+  std::size_t index{0};  // структуры индексов вне узлов
+  std::size_t slack{0};  // накладные расходы аллокатора и пустые слоты
+
+  std::size_t total() const noexcept {
+    return nodes + keys + index + slack;
+  }
+};
+
+// Точка настройки: байты в куче, принадлежащие ключу. Ищется по ADL, так что
+// перегрузку можно объявить рядом со своим типом ключа. По умолчанию -- 0.
+template <typename T>
+std::size_t heap_usage(const T&) noexcept {
+  return 0;
+}
+
+template <typename C, typename Traits, typename Alloc>
+std::size_t heap_usage(const std::basic_string<C, Traits, Alloc>& str) noexcept {
+  auto* data = reinterpret_cast<const char*>(str.data());
+  auto* self = reinterpret_cast<const char*>(&str);
+  if (data >= self && data < self + sizeof(str)) {
+    // короткая строка, буфер -- часть самого объекта
+    return 0;
+  }
+  return (str.capacity() + 1) * sizeof(C);
+}
+
+template <typename T>
+std::size_t key_heap_usage(const T& key) noexcept {
+  using intrusive::heap_usage;
+  return heap_usage(key);
+}
+
+// Сколько байт аллокатор тратит сверх `size` на блок по адресу `ptr`.
+inline std::size_t allocation_slack(const void* ptr, std::size_t size) noexcept {
+#if defined(__GLIBC__)
+  // доступный размер плюс заголовок блока
+  return malloc_usable_size(const_cast<void*>(ptr)) + sizeof(std::size_t) - size;
+#else
+  (void)ptr;
+  (void)size;
+  return 0;
+#endif
+}
+
+} // namespace intrusive
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bimap.h"
+
+// Потокобезопасный bimap для многопоточной вставки: пары разложены по
+// N независимым bimap (шардам) по хешу left, у каждого шарда свой мьютекс.
+// Справочник right -> номер шарда, разбитый на столько же полос со своими
+// мьютексами, обеспечивает уникальность right между шардами и поиск по right.
+// Справочник хеширован по HashRight, который должен быть согласован с
+// CompareRight: эквивалентные right дают один хеш.
+//
+// Мьютексы всегда берутся в порядке: шард, затем полоса справочника.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+struct sharded_bimap {
+
+  using left_t = Left;
+  using right_t = Right;
+  using map_t = bimap<Left, Right, CompareLeft, CompareRight>;
+
+private:
+  // по отдельной кеш-линии на шард, чтобы мьютексы не делили линию
+  struct alignas(64) shard_t {
+    shard_t(const CompareLeft& compare_left, const CompareRight& compare_right)
+        : map(compare_left, compare_right) {}
+
+    std::mutex mutex;
+    map_t map;
+  };
+
+  // равенство right в справочнике -- эквивалентность по CompareRight
+  struct right_equal {
+    bool operator()(const Right& a, const Right& b) const {
+      return !compare(a, b) && !compare(b, a);
+    }
+
+    CompareRight compare;
+  };
+
+  using directory_t = std::unordered_map<Right, std::size_t, HashRight, right_equal>;
+
+  struct alignas(64) stripe_t {
+    explicit stripe_t(const CompareRight& compare_right)
+        : shard_of(0, HashRight(), right_equal{compare_right}) {}
+
+    std::mutex mutex;
+    directory_t shard_of;
+  };
+
+  using right_iterator = decltype(std::declval<map_t&>().end_right());
+
+  template <typename Side>
+  struct side_traits;
+
+public:
+  // Обход всех пар в порядке одной из сторон. Держит мьютексы всех шардов
+  // все время своей жизни, итераторы сливают упорядоченные шарды.
+  // Вызов других методов sharded_bimap из того же потока, пока жив
+  // ordered_view, приводит к взаимоблокировке.
+  template <typename Side>
+  struct ordered_view {
+
+    using map_iterator = decltype(side_traits<Side>::begin(std::declval<map_t&>()));
+
+    struct iterator {
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<const Left&, const Right&>;
+      using reference = value_type;
+      using pointer = void;
+      using difference_type = std::ptrdiff_t;
+
+      // Пара (left, right), на которую ссылается итератор
+      value_type operator*() const {
+        return side_traits<Side>::pair(positions[current]);
+      }
+
+      iterator& operator++() {
+        ++positions[current];
+        select();
+        return *this;
+      }
+
+      iterator operator++(int) {
+        iterator copy = *this;
+        operator++();
+        return copy;
+      }
+
+      // у end() позиций нет, с ним совпадает любой дошедший до конца итератор
+      friend bool operator==(const iterator& a, const iterator& b) {
+        if (a.current != b.current) {
+          return false;
+        }
+        return a.current >= a.positions.size() ||
+               a.positions[a.current] == b.positions[b.current];
+      }
+
+      friend bool operator!=(const iterator& a, const iterator& b) {
+        return !(a == b);
+      }
+
+    private:
+      friend ordered_view;
+
+      iterator(const ordered_view* view, bool at_end) : view(view) {
+        if (at_end) {
+          current = view->shards.size();
+          return;
+        }
+        for (shard_t* shard : view->shards) {
+          positions.push_back(side_traits<Side>::begin(shard->map));
+        }
+        select();
+      }
+
+      // шардов немного, минимум ищется линейным проходом
+      void select() {
+        current = view->shards.size();
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+          if (positions[i] == side_traits<Side>::end(view->shards[i]->map)) {
+            continue;
+          }
+          if (current == view->shards.size() ||
+              view->compare(*positions[i], *positions[current])) {
+            current = i;
+          }
+        }
+      }
+
+      const ordered_view* view;
+      std::vector<map_iterator> positions;
+      std::size_t current{0};
+    };
+
+    iterator begin() const {
+      return iterator(this, false);
+    }
+
+    iterator end() const {
+      return iterator(this, true);
+    }
+
+  private:
+    friend sharded_bimap;
+
+    explicit ordered_view(const sharded_bimap& owner)
+        : compare(side_traits<Side>::comparator(owner)) {
+      for (auto& shard : owner.shards) {
+        locks.emplace_back(shard->mutex);
+        shards.push_back(shard.get());
+      }
+    }
+
+    typename side_traits<Side>::compare_t compare;
+    std::vector<shard_t*> shards;
+    std::vector<std::unique_lock<std::mutex>> locks;
+  };
+
+  explicit sharded_bimap(std::size_t shard_count = default_shard_count(),
+                         CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight())
+      : compare_left(compare_left), compare_right(compare_right) {
+    for (std::size_t i = 0; i < shard_count; ++i) {
+      shards.push_back(std::make_unique<shard_t>(compare_left, compare_right));
+      stripes.push_back(std::make_unique<stripe_t>(compare_right));
+    }
+  }
+
+  sharded_bimap(const sharded_bimap&) = delete;
+
+  sharded_bimap& operator=(const sharded_bimap&) = delete;
+
+  // Вставка пары (left, right). Возвращает false и ничего не делает, если
+  // такой left или такой right уже есть в каком-либо шарде.
+  // Узлы пары и справочника строятся до мьютексов, а если вставка не
+  // удалась, освобождаются после них; под мьютексами память выделяет только
+  // редкое перехеширование справочника.
+  template <typename L = Left, typename R = Right>
+  bool insert(L&& left, R&& right) {
+    typename map_t::node_handle node =
+        map_t::make_node(std::forward<L>(left), std::forward<R>(right));
+    std::size_t index = shard_index(node.left());
+    typename directory_t::node_type entry = directory_entry(node.right(), index);
+    shard_t& shard = *shards[index];
+    stripe_t& stripe = stripe_of(node.right());
+    std::lock_guard shard_guard(shard.mutex);
+    std::lock_guard stripe_guard(stripe.mutex);
+    auto placed = stripe.shard_of.insert(std::move(entry));
+    if (!placed.inserted) {
+      entry = std::move(placed.node);
+      return false;
+    }
+    try {
+      if (shard.map.insert(std::move(node)) != shard.map.end_left()) {
+        return true;
+      }
+    } catch (...) {
+      entry = stripe.shard_of.extract(placed.position);
+      throw;
+    }
+    entry = stripe.shard_of.extract(placed.position);
+    return false;
+  }
+
+  bool insert(const Left& left, const Right& right) {
+    return insert<const Left&, const Right&>(left, right);
+  }
+
+  // Удаляет пару по left, возвращает была ли пара удалена
+  bool erase_left(const Left& left) {
+    shard_t& shard = *shards[shard_index(left)];
+    std::lock_guard shard_guard(shard.mutex);
+    auto it = shard.map.find_left(left);
+    if (it == shard.map.end_left()) {
+      return false;
+    }
+    stripe_t& stripe = stripe_of(*it.flip());
+    std::lock_guard stripe_guard(stripe.mutex);
+    stripe.shard_of.erase(*it.flip());
+    shard.map.erase_left(it);
+    return true;
+  }
+
+  // Удаляет пару по right, возвращает была ли пара удалена
+  bool erase_right(const Right& right) {
+    return with_right(right, [&](shard_t& shard, stripe_t& stripe, right_iterator it) {
+      stripe.shard_of.erase(right);
+      shard.map.erase_right(it);
+      return true;
+    }).value_or(false);
+  }
+
+  // Возвращают копию парного элемента, если он есть
+  std::optional<Right> find_left(const Left& left) const {
+    shard_t& shard = *shards[shard_index(left)];
+    std::lock_guard shard_guard(shard.mutex);
+    auto it = shard.map.find_left(left);
+    if (it == shard.map.end_left()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+
+  std::optional<Left> find_right(const Right& right) const {
+    return with_right(right, [](shard_t&, stripe_t&, right_iterator it) {
+      return *it.flip();
+    });
+  }
+
+  // Если элемента не существует -- бросает std::out_of_range
+  Right at_left(const Left& left) const {
+    if (auto right = find_left(left)) {
+      return *right;
+    }
+    throw std::out_of_range("Expected existing key");
+  }
+
+  Left at_right(const Right& right) const {
+    if (auto left = find_right(right)) {
+      return *left;
+    }
+    throw std::out_of_range("Expected existing key");
+  }
+
+  // Размер на момент вызова; при параллельных вставках может сразу устареть
+  std::size_t size() const {
+    std::size_t result = 0;
+    for (auto& shard : shards) {
+      std::lock_guard guard(shard->mutex);
+      result += shard->map.size();
+    }
+    return result;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  std::size_t shard_count() const noexcept {
+    return shards.size();
+  }
+
+  ordered_view<left_tag> ordered_left() const {
+    return ordered_view<left_tag>(*this);
+  }
+
+  ordered_view<right_tag> ordered_right() const {
+    return ordered_view<right_tag>(*this);
+  }
+
+private:
+  static std::size_t default_shard_count() noexcept {
+    return std::max(1u, std::thread::hardware_concurrency()) * 4;
+  }
+
+  std::size_t shard_index(const Left& left) const {
+    return HashLeft()(left) % shards.size();
+  }
+
+  stripe_t& stripe_of(const Right& right) const {
+    return *stripes[HashRight()(right) % stripes.size()];
+  }
+
+  // Узел справочника вне полос. Таблица, из которой он берется, своя у
+  // потока, чтобы не выделять ей корзины на каждую вставку.
+  static typename directory_t::node_type directory_entry(const Right& right,
+                                                         std::size_t index) {
+    thread_local directory_t spare;
+    return spare.extract(spare.emplace(right, index).first);
+  }
+
+  // Находит шард по справочнику и вызывает f под мьютексами шарда и полосы.
+  // Справочник перечитывается под мьютексом шарда: пара могла переехать,
+  // пока мьютексы были отпущены.
+  template <typename F>
+  auto with_right(const Right& right, F f) const
+      -> std::optional<std::invoke_result_t<F, shard_t&, stripe_t&, right_iterator>> {
+    stripe_t& stripe = stripe_of(right);
+    while (true) {
+      std::size_t index;
+      {
+        std::lock_guard stripe_guard(stripe.mutex);
+        auto it = stripe.shard_of.find(right);
+        if (it == stripe.shard_of.end()) {
+          return std::nullopt;
+        }
+        index = it->second;
+      }
+      shard_t& shard = *shards[index];
+      std::lock_guard shard_guard(shard.mutex);
+      std::lock_guard stripe_guard(stripe.mutex);
+      auto it = stripe.shard_of.find(right);
+      if (it == stripe.shard_of.end()) {
+        return std::nullopt;
+      }
+      if (it->second == index) {
+        return f(shard, stripe, shard.map.find_right(right));
+      }
+    }
+  }
+
+  CompareLeft compare_left;
+  CompareRight compare_right;
+  std::vector<std::unique_ptr<shard_t>> shards;
+  std::vector<std::unique_ptr<stripe_t>> stripes;
+};
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename HashLeft, typename HashRight>
+template <typename Side>
+struct sharded_bimap<Left, Right, CompareLeft, CompareRight, HashLeft,
+                     HashRight>::side_traits {
+
+  using compare_t = std::conditional_t<std::is_same_v<Side, left_tag>,
+                                       CompareLeft, CompareRight>;
+
+  static auto begin(map_t& map) {
+    if constexpr (std::is_same_v<Side, left_tag>) {
+      return map.begin_left();
+    } else {
+      return map.begin_right();
+    }
+  }
+
+  static auto end(map_t& map) {
+    if constexpr (std::is_same_v<Side, left_tag>) {
+      return map.end_left();
+    } else {
+      return map.end_right();
+    }
+  }
+
+  template <typename It>
+  static std::pair<const Left&, const Right&> pair(const It& it) {
+    if constexpr (std::is_same_v<Side, left_tag>) {
+      return {*it, *it.flip()};
+    } else {
+      return {*it.flip(), *it};
+    }
+  }
+
+  static compare_t comparator(const sharded_bimap& owner) {
+    if constexpr (std::is_same_v<Side, left_tag>) {
+      return owner.compare_left;
+    } else {
+      return owner.compare_right;
+    }
+  }
+};
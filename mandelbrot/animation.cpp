@@ -0,0 +1,223 @@
+#include "animation.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Кадры [first, last), которые считаются вместе: из ключевой картинки или,
+// без нее, один кадр сам по себе
+struct animation_job {
+    size_t first;
+    size_t last;
+    bool keyed;
+    view v;  // ключевой картинки; без нее -- кадра
+};
+
+double_double center_x(const view &v) {
+    return {v.x_center, v.x_center_lo};
+}
+
+double_double center_y(const view &v) {
+    return {v.y_center, v.y_center_lo};
+}
+
+// Ключевые картинки жадно, с первого еще не покрытого кадра: к ней добавляются
+// кадры, пока прямоугольник всех их на плоскости в пикселях самого мелкого из
+// них не больше key_zoom кадров по каждой стороне. Ключевая картинка стоит
+// примерно key_zoom^2 кадров, так что покрывшая меньше не окупается
+std::vector<animation_job> plan_jobs(const std::vector<keyframe> &path, const animation_options &options) {
+    size_t frames = path.back().frame + 1;
+    // запас на округление: картинка чуть больше прямоугольника кадров
+    const double MARGIN = 3;
+    double max_w = std::ceil(options.width * options.key_zoom) + MARGIN;
+    double max_h = std::ceil(options.height * options.key_zoom) + MARGIN;
+    std::vector<animation_job> jobs;
+    for (size_t f = 0; f < frames;) {
+        view first = frame_view(path, f, options.width, options.height, options.max_steps);
+        double x0 = std::numeric_limits<double>::max();
+        double x1 = std::numeric_limits<double>::lowest();
+        double y0 = x0;
+        double y1 = x1;
+        double scale = first.scale;
+        size_t last = f;
+        view key;
+        for (size_t g = f; g < frames && options.key_zoom > 1; ++g) {
+            view v = g == f ? first : frame_view(path, g, options.width, options.height, options.max_steps);
+            if (v.power != first.power) {
+                break;
+            }
+            // края кадра относительно центра первого
+            double dx = (center_x(v) - center_x(first)).hi;
+            double dy = (center_y(v) - center_y(first)).hi;
+            double left = std::min(x0, dx - static_cast<double>(v.width / 2) * v.scale);
+            double right = std::max(x1, dx + static_cast<double>(v.width - v.width / 2) * v.scale);
+            double top = std::min(y0, dy - static_cast<double>(v.height / 2) * v.scale);
+            double bottom = std::max(y1, dy + static_cast<double>(v.height - v.height / 2) * v.scale);
+            double s = std::min(scale, v.scale);
+            double w = std::ceil((right - left) / s) + MARGIN;
+            double h = std::ceil((bottom - top) / s) + MARGIN;
+            if (w > max_w || h > max_h) {
+                break;
+            }
+            x0 = left;
+            x1 = right;
+            y0 = top;
+            y1 = bottom;
+            scale = s;
+            last = g + 1;
+            double_double x = center_x(first) + (left + right) / 2;
+            double_double y = center_y(first) + (top + bottom) / 2;
+            key = {x.hi, y.hi, s, first.power, static_cast<size_t>(w), static_cast<size_t>(h), x.lo, y.lo,
+                   options.max_steps > 0 ? options.max_steps : max_steps_for(s)};
+        }
+        if (last - f > options.key_zoom * options.key_zoom) {
+            jobs.push_back({f, last, true, key});
+            f = last;
+        } else {
+            jobs.push_back({f, f + 1, false, first});
+            ++f;
+        }
+    }
+    return jobs;
+}
+
+// Пиксели ключевой картинки [from[i], to[i]) по одной оси, попавшие в i-й из n
+// пикселей кадра. offset -- сдвиг центра кадра от центра ключевой, а ratio --
+// пикселей ключевой в пикселе кадра
+void footprints(size_t n, size_t key_n, double offset, double ratio,
+                std::vector<size_t> &from, std::vector<size_t> &to) {
+    from.resize(n);
+    to.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        double center = (static_cast<double>(i) - static_cast<double>(n / 2)) * ratio + offset
+                        + static_cast<double>(key_n / 2);
+        double first = std::floor(center - ratio / 2 + 0.5);
+        double last = std::floor(center + ratio / 2 + 0.5);
+        from[i] = static_cast<size_t>(std::clamp(first, 0., static_cast<double>(key_n - 1)));
+        to[i] = static_cast<size_t>(std::clamp(last, static_cast<double>(from[i] + 1), static_cast<double>(key_n)));
+    }
+}
+
+// Кадр v уменьшением ключевой картинки key с числами итераций steps
+void resample(const view &key, const std::uint16_t *steps, const view &v, const palette &colors,
+              unsigned char *data, std::vector<size_t> (&bounds)[4]) {
+    double ratio = v.scale / key.scale;
+    footprints(v.width, key.width, (center_x(v) - center_x(key)).hi / key.scale, ratio, bounds[0], bounds[1]);
+    footprints(v.height, key.height, (center_y(v) - center_y(key)).hi / key.scale, ratio, bounds[2], bounds[3]);
+    for (size_t y = 0; y < v.height; ++y) {
+        unsigned char *p = data + 3 * y * v.width;
+        for (size_t x = 0; x < v.width; ++x) {
+            unsigned sum[3]{};
+            for (size_t j = bounds[2][y]; j < bounds[3][y]; ++j) {
+                const std::uint16_t *row = steps + j * key.width;
+                for (size_t i = bounds[0][x]; i < bounds[1][x]; ++i) {
+                    const unsigned char *c = colors.color(row[i]);
+                    sum[0] += c[0];
+                    sum[1] += c[1];
+                    sum[2] += c[2];
+                }
+            }
+            unsigned count = (bounds[1][x] - bounds[0][x]) * (bounds[3][y] - bounds[2][y]);
+            for (size_t k = 0; k < 3; ++k) {
+                *p++ = static_cast<unsigned char>((sum[k] + count / 2) / count);
+            }
+        }
+    }
+}
+
+}
+
+view frame_view(const std::vector<keyframe> &path, size_t frame, size_t w, size_t h, unsigned max_steps) {
+    size_t k = 0;
+    while (k + 2 < path.size() && path[k + 1].frame <= frame) {
+        ++k;
+    }
+    const keyframe &a = path[k];
+    const keyframe &b = path[std::min(k + 1, path.size() - 1)];
+    double u = b.frame > a.frame
+               ? std::clamp((static_cast<double>(frame) - a.frame) / static_cast<double>(b.frame - a.frame), 0., 1.)
+               : 0.;
+    double scale = a.scale * std::pow(b.scale / a.scale, u);
+    // смещение центра на экране пропорционально пройденному масштабу: в
+    // пикселях центр движется с постоянной скоростью
+    double t = a.scale != b.scale ? (a.scale - scale) / (a.scale - b.scale) : u;
+    double_double x = a.x_center + (b.x_center - a.x_center) * t;
+    double_double y = a.y_center + (b.y_center - a.y_center) * t;
+    return {x.hi, y.hi, scale, a.power + (b.power - a.power) * u, w, h, x.lo, y.lo,
+            max_steps > 0 ? max_steps : max_steps_for(scale)};
+}
+
+animation_stats render_animation(const std::vector<keyframe> &path, const animation_options &options,
+                                 const frame_sink &sink) {
+    animation_stats total;
+    if (path.empty()) {
+        return total;
+    }
+    std::vector<animation_job> jobs = plan_jobs(path, options);
+    size_t in_flight = std::clamp<size_t>(options.in_flight, 1, jobs.size());
+    // потоки одного задания простаивают на его хвосте и пока кадры пишутся в
+    // файлы, поэтому их чуть больше, чем поровну
+    size_t n_threads = std::max<size_t>(1, (options.n_threads + in_flight - 1) / in_flight);
+
+    std::atomic_size_t next{0};
+    std::mutex mutex_;
+    std::exception_ptr error;
+    auto run = [&] {
+        std::vector<std::uint16_t> steps;
+        std::vector<unsigned char> data(3 * options.width * options.height);
+        std::vector<size_t> bounds[4];
+        render_stats stats;
+        for (size_t i; (i = next++) < jobs.size();) {
+            const animation_job &job = jobs[i];
+            render_options frame_options;
+            frame_options.first_precision = 1;
+            frame_options.subdivide = options.subdivide;
+            try {
+                if (!job.keyed) {
+                    palette colors(options.coloring, job.v.max_steps, options.contrast);
+                    frame_options.colors = &colors;
+                    frame_options.antialias = options.antialias;
+                    stats += render(job.v, frame_options, {data.data(), 3 * options.width}, n_threads);
+                    sink(job.first, data.data());
+                    continue;
+                }
+                steps.resize(job.v.width * job.v.height);
+                stats += render(job.v, frame_options, {nullptr, 0, steps.data()}, n_threads);
+                for (size_t f = job.first; f < job.last; ++f) {
+                    view v = frame_view(path, f, options.width, options.height, options.max_steps);
+                    palette colors(options.coloring, v.max_steps, options.contrast);
+                    resample(job.v, steps.data(), v, colors, data.data(), bounds);
+                    sink(f, data.data());
+                }
+            } catch (...) {
+                std::lock_guard guard(mutex_);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = jobs.size();
+            }
+        }
+        std::lock_guard guard(mutex_);
+        total.stats += stats;
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < in_flight; ++i) {
+        threads.emplace_back(run);
+    }
+    run();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    total.frames = path.back().frame + 1;
+    total.keys = std::count_if(jobs.begin(), jobs.end(), [](const animation_job &job) { return job.keyed; });
+    return total;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "double_double.h"
+#include "palette.h"
+#include "renderer.h"
+
+// Пакетный рендер зума по ключевым точкам пути, без окна. Кадры между точками
+// интерполируются: масштаб -- геометрически, центр -- так, чтобы на экране он
+// двигался равномерно при любом зуме, степень -- линейно.
+// Соседние кадры зума почти одинаковы, поэтому их не считают по одному: одна
+// ключевая картинка мельче самого мелкого из них покрывает несколько кадров
+// подряд, а кадры получаются из нее уменьшением -- средним цветом пикселей
+// ключевой, попавших в пиксель кадра (заодно это и сглаживание). Раскраска --
+// по пределу итераций каждого кадра, как если бы он считался сам.
+// Ключевые картинки и отдельные кадры считаются по нескольку одновременно.
+
+struct keyframe {
+    size_t frame;
+    double_double x_center;
+    double_double y_center;
+    double scale;
+    double power{2};
+};
+
+struct animation_options {
+    size_t width{1920};
+    size_t height{1080};
+    unsigned max_steps{0};                // 0 -- по масштабу кадра, max_steps_for
+    bool subdivide{true};
+    bool antialias{false};                // для кадров, считающихся без ключевой картинки
+    palette::coloring coloring{palette::classic};
+    double contrast{1};
+    size_t n_threads{1};
+    size_t in_flight{1};                  // ключевых картинок и кадров одновременно
+    double key_zoom{2};                   // во сколько раз ключевая картинка больше кадра
+                                          // по стороне; 1 -- каждый кадр считается сам
+};
+
+struct animation_stats {
+    size_t frames{0};
+    size_t keys{0};       // ключевых картинок
+    render_stats stats;
+};
+
+// Вид кадра frame пути path (ключевые точки по возрастанию кадров) размером w x h
+view frame_view(const std::vector<keyframe> &path, size_t frame, size_t w, size_t h, unsigned max_steps = 0);
+
+// Готовый кадр: RGB width x height, 3 * width байт на строку. Зовется из разных
+// потоков и не по порядку кадров
+using frame_sink = std::function<void(size_t frame, const unsigned char *data)>;
+
+// Все кадры пути, от 0 до последней ключевой точки. Исключение из sink
+// останавливает рендер и пробрасывается наружу
+animation_stats render_animation(const std::vector<keyframe> &path, const animation_options &options,
+                                 const frame_sink &sink);
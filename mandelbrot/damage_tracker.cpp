@@ -0,0 +1,27 @@
+#include "damage_tracker.h"
+#include <algorithm>
+
+bool damage_tracker::add(const tile_queue::rect &r) {
+    std::lock_guard guard(mutex_);
+    if (!dirty) {
+        dirty = true;
+        bounds = r;
+        return true;
+    }
+    size_t x0 = std::min(bounds.x, r.x);
+    size_t y0 = std::min(bounds.y, r.y);
+    size_t x1 = std::max(bounds.x + bounds.w, r.x + r.w);
+    size_t y1 = std::max(bounds.y + bounds.h, r.y + r.h);
+    bounds = {x0, y0, x1 - x0, y1 - y0};
+    return false;
+}
+
+bool damage_tracker::take(tile_queue::rect &bounds) {
+    std::lock_guard guard(mutex_);
+    if (!dirty) {
+        return false;
+    }
+    dirty = false;
+    bounds = this->bounds;
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include "tile_queue.h"
+
+// Что перерисовать: тайлы, записанные в картинку с прошлого забора, одним
+// прямоугольником. Потоки добавляют тайлы под блокировкой публикации, поэтому
+// тайлы устаревших кадров сюда не попадают. Окно забирает накопленное не
+// чаще своей частоты кадров, а звать его нужно только добавившему первым
+// после забора: сигналов не больше, чем перерисовок.
+class damage_tracker {
+public:
+    // true -- до r с прошлого забора ничего не накопилось
+    bool add(const tile_queue::rect &r);
+
+    // Накопленное с прошлого забора; false -- ничего
+    bool take(tile_queue::rect &bounds);
+
+private:
+    std::mutex mutex_;
+    bool dirty{false};
+    tile_queue::rect bounds{};
+};
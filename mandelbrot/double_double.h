@@ -0,0 +1,86 @@
+#pragma once
+#include <cmath>
+
+// Число двойной-двойной точности: значение hi + lo, |lo| <= ulp(hi) / 2,
+// около 106 бит мантиссы. Нужно там, где double уже не различает соседние
+// пиксели: центр кадра и опорная орбита глубокого зума.
+struct double_double {
+    double hi{0};
+    double lo{0};
+
+    double_double() = default;
+
+    double_double(double value) : hi(value) {}
+
+    double_double(double hi, double lo) : hi(hi), lo(lo) {}
+
+    explicit operator double() const {
+        return hi + lo;
+    }
+
+    // a + b без потерь: сумма и ошибка ее округления
+    static double_double two_sum(double a, double b) {
+        double s = a + b;
+        double v = s - a;
+        return {s, (a - (s - v)) + (b - v)};
+    }
+
+    // то же при |a| >= |b|
+    static double_double quick_two_sum(double a, double b) {
+        double s = a + b;
+        return {s, b - (s - a)};
+    }
+
+    static double_double two_prod(double a, double b) {
+        double p = a * b;
+        return {p, std::fma(a, b, -p)};
+    }
+
+    double_double &operator+=(const double_double &other) {
+        double_double s = two_sum(hi, other.hi);
+        double_double t = two_sum(lo, other.lo);
+        s.lo += t.hi;
+        s = quick_two_sum(s.hi, s.lo);
+        s.lo += t.lo;
+        return *this = quick_two_sum(s.hi, s.lo);
+    }
+
+    double_double &operator-=(const double_double &other) {
+        return *this += -other;
+    }
+
+    double_double &operator*=(const double_double &other) {
+        double_double p = two_prod(hi, other.hi);
+        p.lo += hi * other.lo + lo * other.hi;
+        return *this = quick_two_sum(p.hi, p.lo);
+    }
+
+    double_double &operator/=(const double_double &other) {
+        double q1 = hi / other.hi;
+        double_double r = *this - other * q1;
+        double q2 = r.hi / other.hi;
+        r -= other * q2;
+        double q3 = r.hi / other.hi;
+        return *this = quick_two_sum(q1, q2) + q3;
+    }
+
+    double_double operator-() const {
+        return {-hi, -lo};
+    }
+
+    friend double_double operator+(double_double a, const double_double &b) {
+        return a += b;
+    }
+
+    friend double_double operator-(double_double a, const double_double &b) {
+        return a -= b;
+    }
+
+    friend double_double operator*(double_double a, const double_double &b) {
+        return a *= b;
+    }
+
+    friend double_double operator/(double_double a, const double_double &b) {
+        return a /= b;
+    }
+};
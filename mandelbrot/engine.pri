@@ -0,0 +1,36 @@
+# Вычисление кадров без Qt, общее для виджета и консольной версии
+
+SOURCES += \
+    $$PWD/animation.cpp \
+    $$PWD/damage_tracker.cpp \
+    $$PWD/frame_buffers.cpp \
+    $$PWD/frame_scheduler.cpp \
+    $$PWD/kernel.cpp \
+    $$PWD/kernel_avx2.cpp \
+    $$PWD/kernel_avx512.cpp \
+    $$PWD/kernel_sse2.cpp \
+    $$PWD/palette.cpp \
+    $$PWD/perturbation.cpp \
+    $$PWD/render_job.cpp \
+    $$PWD/renderer.cpp \
+    $$PWD/sampler.cpp \
+    $$PWD/tile_cache.cpp \
+    $$PWD/tile_queue.cpp
+
+HEADERS += \
+    $$PWD/animation.h \
+    $$PWD/damage_tracker.h \
+    $$PWD/double_double.h \
+    $$PWD/frame_buffers.h \
+    $$PWD/frame_scheduler.h \
+    $$PWD/kernel.h \
+    $$PWD/kernel_simd.h \
+    $$PWD/palette.h \
+    $$PWD/perturbation.h \
+    $$PWD/render_job.h \
+    $$PWD/renderer.h \
+    $$PWD/sampler.h \
+    $$PWD/tile_cache.h \
+    $$PWD/tile_queue.h
+
+INCLUDEPATH += $$PWD
@@ -0,0 +1,51 @@
+#include "frame_buffers.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+void frame_buffers::resize(size_t w, size_t h) {
+    this->w = w;
+    this->h = h;
+    // при уменьшении вектор памяти не отдает, при возврате к прежнему размеру не выделяет
+    work_bits.resize(stride() * h);
+    steps.resize(w * h);
+    display_bits.resize(stride() * h);
+}
+
+size_t frame_buffers::width() const {
+    return w;
+}
+
+size_t frame_buffers::height() const {
+    return h;
+}
+
+size_t frame_buffers::stride() const {
+    return 3 * w;
+}
+
+frame_buffer frame_buffers::work() {
+    return {work_bits.data(), stride(), steps.data()};
+}
+
+unsigned char *frame_buffers::display() {
+    return display_bits.data();
+}
+
+void frame_buffers::present(const tile_queue::rect &r, tile_queue &queue) {
+    const size_t CELL = tile_queue::TILE_SIZE;
+    size_t x1 = std::min(r.x + r.w, w);
+    size_t y1 = std::min(r.y + r.h, h);
+    for (size_t y = r.y / CELL * CELL; y < y1; y += CELL) {
+        for (size_t x = r.x / CELL * CELL; x < x1; x += CELL) {
+            size_t x0 = std::max(x, r.x);
+            size_t y0 = std::max(y, r.y);
+            size_t bytes = 3 * (std::min(x + CELL, x1) - x0);
+            std::lock_guard guard(queue.tile_mutex(x, y));
+            for (size_t y_ = y0; y_ < std::min(y + CELL, y1); ++y_) {
+                size_t offset = y_ * stride() + 3 * x0;
+                std::memcpy(display_bits.data() + offset, work_bits.data() + offset, bytes);
+            }
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "renderer.h"
+#include "tile_queue.h"
+
+// Буферы кадра окна. Потоки пишут в рабочий -- RGB и числа итераций, там же
+// сдвигается картинка при перетаскивании. Окно рисует из показываемого, куда
+// готовое копируется по клеткам тайлов под их мьютексами: недописанный тайл
+// не виден, а поток ждет, только если пишет ту самую клетку. Пишет в
+// показываемый буфер и рисует из него один поток окна, так что рисование
+// потоков не ждет. Память при смене размера переиспользуется.
+class frame_buffers {
+public:
+    // Вызывать, когда потоки отменены, под исключительной блокировкой публикации:
+    // указатели из work() прежнего размера больше недействительны
+    void resize(size_t w, size_t h);
+
+    size_t width() const;
+    size_t height() const;
+    size_t stride() const;  // байт на строку в обоих буферах
+
+    frame_buffer work();
+    unsigned char *display();
+
+    // Копирует прямоугольник r из рабочего буфера в показываемый
+    void present(const tile_queue::rect &r, tile_queue &queue);
+
+private:
+    size_t w{0};
+    size_t h{0};
+    std::vector<unsigned char> work_bits;
+    std::vector<std::uint16_t> steps;
+    std::vector<unsigned char> display_bits;
+};
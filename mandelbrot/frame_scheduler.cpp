@@ -0,0 +1,56 @@
+#include "frame_scheduler.h"
+#include <algorithm>
+#include <cmath>
+
+void frame_scheduler::observe(const std::uint16_t *steps, size_t count) {
+    unsigned fastest = current.max_steps;
+    for (size_t i = 0; i < count; ++i) {
+        fastest = std::min<unsigned>(fastest, steps[i]);
+    }
+    observed = true;
+    observed_scale = current_scale;
+    observed_steps = current.max_steps;
+    floor = fastest;
+}
+
+unsigned frame_scheduler::full_steps(double scale) const {
+    unsigned span = max_steps_for(scale);
+    if (!observed || std::abs(std::log2(scale / observed_scale)) > FLOOR_OCTAVES) {
+        return span;
+    }
+    if (floor >= observed_steps) {
+        return std::clamp(2 * observed_steps, span, STEPS_LIMIT);
+    }
+    // span итераций от floor-й; в кадре у края плоскости быстрее всего выходят за одну
+    return std::min(span + std::max(floor, 1u) - 1, STEPS_LIMIT);
+}
+
+frame_scheduler::plan frame_scheduler::next(double scale, size_t pixels, bool interactive,
+                                            const tile_queue::load_stats &last) {
+    if (last.first_samples > 0) {
+        double measured = std::chrono::duration<double>(last.first_pass).count() / last.first_samples
+                          / current.max_steps;
+        // один кадр может попасть на вытеснение потоков, поэтому пополам с прошлой оценкой
+        cost = cost > 0 ? (cost + measured) / 2 : measured;
+    }
+    unsigned steps = full_steps(scale);
+    current = {FIRST_PRECISION, steps};
+    current_scale = scale;
+    if (interactive && cost > 0) {
+        double budget = std::chrono::duration<double>(FRAME_BUDGET).count();
+        auto first_pass = [&](size_t precision, double max_steps) {
+            return cost * pixels / (precision * precision) * max_steps;
+        };
+        while (first_pass(current.first_precision, steps) > budget
+               && current.first_precision < MAX_FIRST_PRECISION) {
+            current.first_precision *= STEP_PRECISION;
+        }
+        double affordable = budget / first_pass(current.first_precision, 1);
+        current.max_steps = static_cast<unsigned>(std::clamp<double>(affordable, std::min(MIN_STEPS, steps), steps));
+    }
+    return current;
+}
+
+bool frame_scheduler::refine(double scale) const {
+    return current.max_steps != full_steps(scale);
+}
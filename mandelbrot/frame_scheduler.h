@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "renderer.h"
+#include "tile_queue.h"
+
+// Предел итераций и бюджет времени кадров окна.
+// Предел -- max_steps_for(scale) итераций сверх самого быстрого выхода в
+// последнем законченном кадре: картинку глубоко у границы множества все точки
+// покидают не сразу, и первые сотни итераций там ничего не различают. Если
+// ни одна точка не вышла, предел удваивается.
+// Пока картинку двигают, первый проход кадра должен укладываться в
+// FRAME_BUDGET: его сетка грубее, а если и этого мало -- итераций меньше.
+// Стоимость отсчета-итерации оценивается по первым проходам прошлых кадров.
+class frame_scheduler {
+public:
+    constexpr static std::chrono::milliseconds FRAME_BUDGET{16};
+    constexpr static size_t MAX_FIRST_PRECISION = FIRST_PRECISION * STEP_PRECISION * STEP_PRECISION;
+
+    struct plan {
+        size_t first_precision{FIRST_PRECISION};
+        unsigned max_steps{MAX_STEPS};
+    };
+
+    // Числа итераций последнего законченного кадра, count пикселей
+    void observe(const std::uint16_t *steps, size_t count);
+
+    // План следующего кадра pixels пикселей с масштабом scale. interactive --
+    // кадр по вводу; last -- статистика очереди, в ней еще прошлый кадр
+    plan next(double scale, size_t pixels, bool interactive, const tile_queue::load_stats &last);
+
+    // Кадр вне ввода с масштабом scale считался бы с другим пределом итераций,
+    // чем последний: тот урезан или по законченному кадру предел сдвинулся
+    bool refine(double scale) const;
+
+private:
+    // дальше по зуму самый быстрый выход прошлого кадра ничего не говорит
+    constexpr static double FLOOR_OCTAVES = 4;
+
+    unsigned full_steps(double scale) const;
+
+    plan current;
+    double current_scale{DEFAULT_SCALE};
+    double cost{0};  // секунд на отсчет-итерацию первого прохода; 0 -- еще не измерена
+
+    bool observed{false};
+    double observed_scale{0};
+    unsigned observed_steps{0};  // предел итераций наблюденного кадра
+    unsigned floor{0};           // самый быстрый выход в нем; observed_steps -- никто не вышел
+};
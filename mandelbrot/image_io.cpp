@@ -0,0 +1,106 @@
+#include "image_io.h"
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+static void write_ppm(std::ofstream &out, const unsigned char *data, size_t width,
+                      size_t height, size_t stride) {
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    for (size_t y = 0; y < height; ++y) {
+        out.write(reinterpret_cast<const char *>(data + y * stride), 3 * width);
+    }
+}
+
+static uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_u32(std::vector<unsigned char> &out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+static void write_chunk(std::ofstream &out, const char *type, const std::vector<unsigned char> &body) {
+    std::vector<unsigned char> chunk;
+    put_u32(chunk, body.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), body.begin(), body.end());
+    put_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+    out.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+}
+
+// PNG без сжатия: deflate из несжатых блоков, чтобы не тянуть zlib
+static void write_png(std::ofstream &out, const unsigned char *data, size_t width,
+                      size_t height, size_t stride) {
+    static const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+    std::vector<unsigned char> header;
+    put_u32(header, width);
+    put_u32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});  // 8 бит, RGB, без чередования строк
+    write_chunk(out, "IHDR", header);
+
+    std::vector<unsigned char> raw;
+    raw.reserve((3 * width + 1) * height);
+    for (size_t y = 0; y < height; ++y) {
+        raw.push_back(0);  // строка без фильтра
+        raw.insert(raw.end(), data + y * stride, data + y * stride + 3 * width);
+    }
+
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    const size_t BLOCK = 65535;
+    for (size_t pos = 0; pos == 0 || pos < raw.size(); pos += BLOCK) {
+        size_t len = std::min(BLOCK, raw.size() - pos);
+        zlib.push_back(pos + len == raw.size() ? 1 : 0);
+        zlib.push_back(len & 0xff);
+        zlib.push_back(len >> 8);
+        zlib.push_back(~len & 0xff);
+        zlib.push_back((~len >> 8) & 0xff);
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+    }
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (unsigned char c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(zlib, b << 16 | a);
+    write_chunk(out, "IDAT", zlib);
+    write_chunk(out, "IEND", {});
+}
+
+void write_image(const std::string &path, const unsigned char *data, size_t width,
+                 size_t height, size_t stride) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    bool png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (png) {
+        write_png(out, data, width, height, stride);
+    } else {
+        write_ppm(out, data, width, height, stride);
+    }
+    if (!out) {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Запись RGB-буфера (3 байта на пиксель, stride байт на строку) в файл.
+// Формат выбирается по расширению: .png, иначе PPM (P6).
+// Бросает std::runtime_error, если файл не удалось записать
+void write_image(const std::string &path, const unsigned char *data, size_t width,
+                 size_t height, size_t stride);
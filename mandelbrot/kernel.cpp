@@ -0,0 +1,97 @@
+#include "kernel.h"
+#include <cmath>
+#include <complex>
+
+#if defined(__GNUC__) && !(defined(__x86_64__) || defined(__i386__))
+// не на x86 выбора при запуске нет: один набор под базовую архитектуру
+#include "kernel_simd.h"
+
+namespace {
+typedef double vd __attribute__((vector_size(16)));
+typedef long long vi __attribute__((vector_size(16)));
+typedef float vf __attribute__((vector_size(16)));
+typedef int vfi __attribute__((vector_size(16)));
+
+constexpr row_kernels kernels_generic = make_kernels<vd, vi, vf, vfi>();
+}
+#endif
+
+static bool in_cardioid_or_bulb(std::complex<double> c) {
+    double x = c.real() - 0.25;
+    double y2 = c.imag() * c.imag();
+    double q = x * x + y2;
+    return q * (q + x) <= 0.25 * y2 || (c.real() + 1) * (c.real() + 1) + y2 <= 0.0625;
+}
+
+void row_scalar(double re, double re_step, double im, double im_step, std::size_t count,
+                double power, unsigned max_steps, std::uint16_t *steps) {
+    for (std::size_t i = 0; i < count; ++i) {
+        std::complex<double> c(re + i * re_step, im + i * im_step);
+        std::complex<double> z = 0;
+        std::complex<double> saved = 0;
+        unsigned saved_at = 1;
+        unsigned step = 0;
+        if (INTERIOR_CHECKS && power == 2 && in_cardioid_or_bulb(c)) {
+            step = max_steps;
+        }
+        while (step < max_steps && std::norm(z) < 4.) {
+            z = std::pow(z, power) + c;
+            ++step;
+            if (!INTERIOR_CHECKS) {
+                continue;
+            }
+            if (step == saved_at) {
+                saved = z;
+                saved_at *= 2;
+            } else if (std::norm(z - saved) < PERIOD_EPSILON * PERIOD_EPSILON) {
+                step = max_steps;
+            }
+        }
+        steps[i] = step;
+    }
+}
+
+static const row_kernels *select_kernels() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (kernels_avx512 && __builtin_cpu_supports("avx512f")) {
+        return kernels_avx512;
+    }
+    if (kernels_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return kernels_avx2;
+    }
+    if (kernels_sse2 && __builtin_cpu_supports("sse2")) {
+        return kernels_sse2;
+    }
+    return nullptr;
+#elif defined(__GNUC__)
+    return &kernels_generic;
+#else
+    return nullptr;
+#endif
+}
+
+static const row_kernels *cpu_kernels() {
+    static const row_kernels *kernels = select_kernels();
+    return kernels;
+}
+
+static bool is_integer_power(double power) {
+    return power >= 2 && power <= MAX_INTEGER_POWER && power == std::floor(power);
+}
+
+row_kernel select_row_kernel(double power) {
+    const row_kernels *kernels = cpu_kernels();
+    if (!kernels) {
+        return row_scalar;
+    }
+    if (is_integer_power(power)) {
+        return kernels->integer[static_cast<unsigned>(power)];
+    }
+    return kernels->polar;
+}
+
+row_kernel select_float_kernel(double power) {
+    const row_kernels *kernels = cpu_kernels();
+    return kernels && is_integer_power(power) ? kernels->integer_float[static_cast<unsigned>(power)] : nullptr;
+}
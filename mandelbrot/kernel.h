@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Числа итераций до выхода для count точек отрезка
+// c = (re + i * re_step) + (im + i * im_step) * i: строки при im_step == 0,
+// столбца при re_step == 0. У не вышедших точек steps[i] == max_steps.
+using row_kernel = void (*)(double re, double re_step, double im, double im_step, std::size_t count,
+                            double power, unsigned max_steps, std::uint16_t *steps);
+
+constexpr unsigned MAX_INTEGER_POWER = 8;
+
+// Ядра заранее останавливаются на точках, которые заведомо не выйдут: для
+// степени 2 -- главная кардиоида и круг периода 2, для любой степени -- орбита,
+// вернувшаяся ближе PERIOD_EPSILON к одной из прошлых точек (циклы по Бренту).
+constexpr double PERIOD_EPSILON = 1e-13;
+
+// Сборка с NO_INTERIOR_CHECKS считает без ранних остановок: так замеряется
+// их выигрыш (mandelbrot_bench.pro, CONFIG+=no_interior_checks)
+#ifdef NO_INTERIOR_CHECKS
+constexpr bool INTERIOR_CHECKS = false;
+#else
+constexpr bool INTERIOR_CHECKS = true;
+#endif
+
+// Ядра, собранные под один набор инструкций: integer[p] считает z^p + c
+// умножениями для p от 2 до MAX_INTEGER_POWER, polar -- любую другую степень
+// через |z|^p и p * arg z. integer_float -- то же во float, вдвое шире.
+struct row_kernels {
+    row_kernel integer[MAX_INTEGER_POWER + 1];
+    row_kernel polar;
+    row_kernel integer_float[MAX_INTEGER_POWER + 1];
+};
+
+// Самое быстрое ядро для степени из поддержанных процессором; выбирается
+// раз на кадр
+row_kernel select_row_kernel(double power);
+
+// Ядро во float для целых степеней; nullptr, если степень не целая или
+// векторные ядра не собраны
+row_kernel select_float_kernel(double power);
+
+// Эталонное ядро через std::pow, если векторные ядра не собраны
+void row_scalar(double re, double re_step, double im, double im_step, std::size_t count,
+                double power, unsigned max_steps, std::uint16_t *steps);
+
+// по 2, 4 и 8 точек; nullptr, если не собраны
+extern const row_kernels *const kernels_sse2;
+extern const row_kernels *const kernels_avx2;
+extern const row_kernels *const kernels_avx512;
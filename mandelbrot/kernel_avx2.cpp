@@ -0,0 +1,31 @@
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#include "kernel_simd.h"
+
+namespace {
+typedef double vd __attribute__((vector_size(32)));
+typedef long long vi __attribute__((vector_size(32)));
+typedef float vf __attribute__((vector_size(32)));
+typedef int vfi __attribute__((vector_size(32)));
+
+constexpr row_kernels table = make_kernels<vd, vi, vf, vfi>();
+}
+
+const row_kernels *const kernels_avx2 = &table;
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#else
+const row_kernels *const kernels_avx2 = nullptr;
+#endif
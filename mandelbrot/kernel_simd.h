@@ -0,0 +1,286 @@
+#pragma once
+// Включается в kernel_<isa>.cpp после их target pragma, так что код ниже
+// собирается под этот набор инструкций. Все -- в анонимном пространстве имен:
+// копии, собранные под разные наборы, компоновщик не должен склеивать.
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+// V -- вектор GCC из double или float, M -- вектор целых того же размера
+// элемента и той же длины. Ядра во float есть только у целых степеней.
+template <typename V>
+using scalar_of = std::decay_t<decltype(std::declval<V>()[0])>;
+
+template <typename V>
+constexpr std::size_t lanes = sizeof(V) / sizeof(scalar_of<V>);
+
+template <typename V, typename M>
+V select(M mask, V a, V b) {
+    return mask ? a : b;
+}
+
+// z^P возведениями в квадрат, развернутыми при компиляции
+template <unsigned P, typename V>
+void integer_pow(V &zr, V &zi) {
+    if constexpr (P == 1) {
+        return;
+    } else if constexpr (P % 2 == 0) {
+        integer_pow<P / 2>(zr, zi);
+        V re = zr * zr - zi * zi;
+        V t = zr * zi;
+        zi = t + t;
+        zr = re;
+    } else {
+        V ar = zr;
+        V ai = zi;
+        integer_pow<P - 1>(zr, zi);
+        V re = zr * ar - zi * ai;
+        zi = zr * ai + zi * ar;
+        zr = re;
+    }
+}
+
+// Приближения ниже точны примерно до 1e-10 на тех отрезках, где их зовет
+// polar_step, -- намного мельче того, что видно на картинке.
+
+// log2(x) при x > 0: порядок -- из битов, мантисса -- через
+// log(m) = 2 atanh((m - 1) / (m + 1)), m в [sqrt(1/2), sqrt(2))
+template <typename V, typename M>
+V fast_log2(V x) {
+    // приведение между векторами одного размера переинтерпретирует биты
+    M bits = (M) x;
+    M e = ((bits >> 52) & 0x7ff) - 1023;
+    M mantissa_bits = (bits & 0xfffffffffffffLL) | 0x3ff0000000000000LL;
+    V m = (V) mantissa_bits;
+    M big = m > 1.4142135623730951;
+    m = select<V>(big, m * 0.5, m);
+    e -= big;
+    V s = (m - 1.) / (m + 1.);
+    V s2 = s * s;
+    V series = 1. + s2 * (1. / 3 + s2 * (1. / 5 + s2 * (1. / 7 + s2 * (1. / 9 + s2 * (1. / 11)))));
+    return __builtin_convertvector(e, V) + 2. * s * series * 1.4426950408889634;
+}
+
+// 2^x; x ограничен снизу, чтобы результат оставался нормализованным
+template <typename V, typename M>
+V fast_exp2(V x) {
+    x = select<V>(x < -1020., V{} - 1020., x);
+    M k = __builtin_convertvector(select<V>(x < 0., x - 0.5, x + 0.5), M);
+    V f = (x - __builtin_convertvector(k, V)) * 0.6931471805599453;
+    V e = 1. + f * (1. + f * (1. / 2 + f * (1. / 6 + f * (1. / 24 + f * (1. / 120 + f * (1. / 720
+            + f * (1. / 5040 + f * (1. / 40320 + f * (1. / 362880 + f * (1. / 3628800))))))))));
+    M bits = (k + 1023) << 52;
+    return e * (V) bits;
+}
+
+// atan2(y, x) в [-pi, pi]
+template <typename V, typename M>
+V fast_atan2(V y, V x) {
+    V ax = select<V>(x < 0., -x, x);
+    V ay = select<V>(y < 0., -y, y);
+    M swap = ay > ax;
+    V num = select<V>(swap, ax, ay);
+    V den = select<V>(swap, ay, ax);
+    V a = num / select<V>(den == 0., V{} + 1., den);
+    // atan(a) = pi/4 + atan((a - 1) / (a + 1)) переводит a в [-tan(pi/8), tan(pi/8)]
+    M reduce = a > 0.41421356237309503;
+    V t = select<V>(reduce, (a - 1.) / (a + 1.), a);
+    V t2 = t * t;
+    V r = t * (1. - t2 * (1. / 3 - t2 * (1. / 5 - t2 * (1. / 7 - t2 * (1. / 9 - t2 * (1. / 11
+            - t2 * (1. / 13 - t2 * (1. / 15 - t2 * (1. / 17 - t2 * (1. / 19 - t2 * (1. / 21)))))))))));
+    r = select<V>(reduce, r + 0.7853981633974483, r);
+    r = select<V>(swap, 1.5707963267948966 - r, r);
+    r = select<V>(x < 0., 3.141592653589793 - r, r);
+    return select<V>(y < 0., -r, r);
+}
+
+// sin и cos при |x| <= 8 pi, с приведением по кратным pi/2
+template <typename V, typename M>
+void fast_sincos(V x, V &sin, V &cos) {
+    V q = x * 0.6366197723675814;
+    M k = __builtin_convertvector(select<V>(q < 0., q - 0.5, q + 0.5), M);
+    V r = x - __builtin_convertvector(k, V) * 1.5707963267948966;
+    V r2 = r * r;
+    V s = r * (1. - r2 * (1. / 6 - r2 * (1. / 120 - r2 * (1. / 5040 - r2 * (1. / 362880
+            - r2 * (1. / 39916800 - r2 * (1. / 6227020800.)))))));
+    V c = 1. - r2 * (1. / 2 - r2 * (1. / 24 - r2 * (1. / 720 - r2 * (1. / 40320
+            - r2 * (1. / 3628800 - r2 * (1. / 479001600.))))));
+    M quadrant = k & 3;
+    V sq = select<V>((quadrant & 1) != 0, c, s);
+    V cq = select<V>((quadrant & 1) != 0, s, c);
+    sin = select<V>(quadrant >= 2, -sq, sq);
+    cos = select<V>((quadrant == 1) | (quadrant == 2), -cq, cq);
+}
+
+// Одна итерация z -> z^p + c; в zr2 и zi2 -- zr * zr и zi * zi.
+// interior() отмечает точки, которые заведомо не выйдут, без итераций;
+// циклы по Бренту ищутся с шага cycle_from() раз в cycle_check_steps шагов.
+template <unsigned P>
+struct integer_step {
+    // главная кардиоида и круг периода 2 -- только у них есть формула
+    template <typename V, typename M>
+    static M interior(V cr, V ci) {
+        using T = scalar_of<V>;
+        if constexpr (P == 2 && INTERIOR_CHECKS) {
+            V x = cr - T(0.25);
+            V ci2 = ci * ci;
+            V q = x * x + ci2;
+            V bulb = (cr + T(1)) * (cr + T(1)) + ci2;
+            return (q * (q + x) <= T(0.25) * ci2) | (bulb <= T(0.0625));
+        } else {
+            return M{};
+        }
+    }
+
+    // сравнение с сохраненной точкой стоит почти как сам шаг, поэтому оно
+    // идет только со второй половины max_steps и реже: точки у границы,
+    // выходящие раньше, за него не платят
+    static unsigned cycle_from(unsigned max_steps) {
+        return max_steps / 2;
+    }
+    static constexpr unsigned cycle_check_steps = 8;
+
+    template <typename V, typename M>
+    static void apply(V &zr, V &zi, V zr2, V zi2, double) {
+        if constexpr (P == 2) {
+            V t = zr * zi;
+            zi = t + t;
+            zr = zr2 - zi2;
+        } else {
+            integer_pow<P>(zr, zi);
+        }
+    }
+};
+
+// z^p = |z|^p (cos p arg z, sin p arg z) для любого вещественного p > 0
+struct polar_step {
+    template <typename V, typename M>
+    static M interior(V, V) {
+        return M{};
+    }
+
+    // шаг через log, exp и sincos много дороже сравнения с сохраненной
+    // точкой, так что циклы ищутся с первого шага и на каждом
+    static unsigned cycle_from(unsigned) {
+        return 0;
+    }
+    static constexpr unsigned cycle_check_steps = 1;
+
+    template <typename V, typename M>
+    static void apply(V &zr, V &zi, V zr2, V zi2, double power) {
+        V r2 = zr2 + zi2;
+        M zero = r2 == 0.;
+        V modulus = fast_exp2<V, M>(fast_log2<V, M>(select<V>(zero, V{} + 1., r2)) * (power / 2));
+        V sin;
+        V cos;
+        fast_sincos<V, M>(fast_atan2<V, M>(zi, zr) * power, sin, cos);
+        zr = select<V>(zero, V{}, modulus * cos);
+        zi = select<V>(zero, V{}, modulus * sin);
+    }
+};
+
+// Свертка по точкам вектора ниже скалярная и тем дороже, чем их больше,
+// поэтому законченные векторы ищутся раз в несколько шагов. Вышедшие точки
+// замаскированы, лишние шаги их числа итераций не меняют.
+constexpr unsigned LANE_CHECK_STEPS = 4;
+
+template <typename M>
+bool any_lane(M mask) {
+    bool any = false;
+    for (std::size_t j = 0; j < lanes<M>; ++j) {
+        any |= mask[j] != 0;
+    }
+    return any;
+}
+
+template <typename V, typename M, typename Step>
+void row_iterate(double re, double re_step, double im, double im_step, std::size_t count,
+                 double power, unsigned max_steps, std::uint16_t *steps) {
+    using T = scalar_of<V>;
+    constexpr std::size_t N = lanes<V>;
+    for (std::size_t i = 0; i < count; i += N) {
+        V cr;
+        V ci;
+        for (std::size_t j = 0; j < N; ++j) {
+            cr[j] = static_cast<T>(re + static_cast<double>(i + j) * re_step);
+            ci[j] = static_cast<T>(im + static_cast<double>(i + j) * im_step);
+        }
+        V zr{};
+        V zi{};
+        M inside = Step::template interior<V, M>(cr, ci);
+        M alive = ~inside;
+        M n = inside & static_cast<scalar_of<M>>(max_steps);
+        // шаг по еще не вышедшим точкам; false, если таких не осталось
+        unsigned step = 0;
+        auto advance = [&] {
+            V zr2 = zr * zr;
+            V zi2 = zi * zi;
+            // вышедшие точки остаются замаскированными, даже если z вернется в круг
+            alive &= (zr2 + zi2 < T(4));
+            if (step % LANE_CHECK_STEPS == 0 && !any_lane(alive)) {
+                return false;
+            }
+            n -= alive;
+            Step::template apply<V, M>(zr, zi, zr2, zi2, power);
+            zr += cr;
+            zi += ci;
+            return true;
+        };
+        unsigned cycle_from = INTERIOR_CHECKS ? Step::cycle_from(max_steps) : max_steps;
+        bool running = true;
+        for (; running && step < cycle_from; ++step) {
+            running = advance();
+        }
+        // Брент: z сравнивается с точкой, сохраненной на последней степени
+        // двойки шагов после cycle_from, так что цикл периода p ловится, как
+        // только это окно перерастет cycle_check_steps * p
+        V saved_r{};
+        V saved_i{};
+        unsigned saved_at = 1;
+        for (; running && step < max_steps; ++step) {
+            if (!advance()) {
+                break;
+            }
+            if (step + 1 - cycle_from == saved_at) {
+                saved_r = zr;
+                saved_i = zi;
+                saved_at *= 2;
+            } else if ((step + 1 - cycle_from - saved_at / 2) % Step::cycle_check_steps == 0) {
+                V dr = zr - saved_r;
+                V di = zi - saved_i;
+                M cycle = alive & (dr * dr + di * di < T(PERIOD_EPSILON * PERIOD_EPSILON));
+                n = (n & ~cycle) | (cycle & static_cast<scalar_of<M>>(max_steps));
+                alive &= ~cycle;
+            }
+        }
+        for (std::size_t j = 0; j < N && i + j < count; ++j) {
+            steps[i + j] = static_cast<std::uint16_t>(n[j]);
+        }
+    }
+}
+
+template <typename V, typename M, std::size_t P>
+constexpr row_kernel integer_kernel() {
+    if constexpr (P < 2) {
+        return nullptr;
+    } else {
+        return row_iterate<V, M, integer_step<P>>;
+    }
+}
+
+// V, M -- для double, VF, MF -- для float той же ширины регистра
+template <typename V, typename M, typename VF, typename MF, std::size_t... P>
+constexpr row_kernels make_kernels(std::index_sequence<P...>) {
+    return {{integer_kernel<V, M, P>()...}, row_iterate<V, M, polar_step>,
+            {integer_kernel<VF, MF, P>()...}};
+}
+
+template <typename V, typename M, typename VF, typename MF>
+constexpr row_kernels make_kernels() {
+    return make_kernels<V, M, VF, MF>(std::make_index_sequence<MAX_INTEGER_POWER + 1>{});
+}
+
+}
@@ -0,0 +1,31 @@
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+#include "kernel_simd.h"
+
+namespace {
+typedef double vd __attribute__((vector_size(16)));
+typedef long long vi __attribute__((vector_size(16)));
+typedef float vf __attribute__((vector_size(16)));
+typedef int vfi __attribute__((vector_size(16)));
+
+constexpr row_kernels table = make_kernels<vd, vi, vf, vfi>();
+}
+
+const row_kernels *const kernels_sse2 = &table;
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#else
+const row_kernels *const kernels_sse2 = nullptr;
+#endif
@@ -9,6 +9,8 @@ CONFIG += sanitizer sanitize_address
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(engine.pri)
+
 SOURCES += \
     main.cpp \
     mainwindow.cpp \
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "kernel.h"
+#include "renderer.h"
+
+// Замер скорости кадров без Qt: mandelbrot_bench печатает лучшее из трех время
+// кадра 960x540 на одном потоке для нескольких видов, с заливкой по
+// Мариани-Силверу и без нее. Выигрыш ранних остановок внутренних точек --
+// разница со сборкой с CONFIG+=no_interior_checks.
+
+constexpr int RUNS = 3;
+
+static double best_ms(const view &v, bool subdivide) {
+    std::vector<unsigned char> rgb(v.width * v.height * 3);
+    render_options options;
+    options.first_precision = 1;
+    options.subdivide = subdivide;
+    double best = 0;
+    for (int i = 0; i < RUNS; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        render(v, options, frame_buffer{rgb.data(), v.width * 3}, 1);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+int main() {
+    struct {
+        const char *name;
+        double x, y, scale, power;
+    } const views[] = {
+        {"default view", 0, 0, DEFAULT_SCALE, 2},
+        {"-0.75+0.1i, scale 5e-4", -0.75, 0.1, 5e-4, 2},
+        {"-0.743+0.131i, scale 2e-6", -0.743, 0.131, 2e-6, 2},
+        {"power 3, default view", 0, 0, DEFAULT_SCALE, 3},
+        {"power 2.5, default view", 0, 0, DEFAULT_SCALE, 2.5},
+    };
+    std::printf("960x540, 1 thread, best of %d, interior checks %s\n", RUNS, INTERIOR_CHECKS ? "on" : "off");
+    for (const auto &p : views) {
+        view v;
+        v.x_center = p.x;
+        v.y_center = p.y;
+        v.scale = p.scale;
+        v.power = p.power;
+        v.width = 960;
+        v.height = 540;
+        v.max_steps = max_steps_for(v.scale);
+        std::printf("%-28s %8.1f ms, no-subdivide %8.1f ms\n", p.name, best_ms(v, true), best_ms(v, false));
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+# Замер скорости кадров без Qt: qmake mandelbrot_bench.pro && make && ./mandelbrot_bench
+# qmake CONFIG+=no_interior_checks mandelbrot_bench.pro -- то же без ранних остановок
+
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+no_interior_checks: DEFINES += NO_INTERIOR_CHECKS
+
+LIBS += -pthread
+QMAKE_CXXFLAGS += -pthread
+
+include(engine.pri)
+
+SOURCES += \
+    mandelbrot_bench.cpp
@@ -0,0 +1,123 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "frame_scheduler.h"
+#include "kernel.h"
+#include "renderer.h"
+
+// Проверки движка без Qt: mandelbrot_check печатает по строке на проверку и
+// возвращает 1, если какая-то не прошла.
+
+// Доля пикселей, в которых float может разойтись с double: точки у границы
+// множества, где округление меняет шаг выхода. Больше всего их у мелкого края
+// уровня FLOAT_SCALE (3e-3): до 0.16% для степени 2 и 0.25% для степени 5
+constexpr double MAX_FLOAT_MISMATCH = 0.003;
+
+// Числа итераций кадра по строкам одним ядром, без заливки и кеша
+static std::vector<std::uint16_t> render_rows(const view &v, row_kernel kernel) {
+    std::vector<std::uint16_t> steps(v.width * v.height);
+    double left = v.x_center - v.scale * static_cast<double>(v.width / 2);
+    for (size_t y = 0; y < v.height; ++y) {
+        double im = v.y_center + v.scale * (static_cast<double>(y) - static_cast<double>(v.height / 2));
+        kernel(left, v.scale, im, 0, v.width, v.power, v.max_steps, &steps[y * v.width]);
+    }
+    return steps;
+}
+
+// Виды, которые считаются во float, через float- и double-ядра: расходится не
+// больше MAX_FLOAT_MISMATCH пикселей
+static bool check_float_kernels() {
+    struct {
+        double x, y, scale, power;
+    } const views[] = {
+        {0, 0, DEFAULT_SCALE, 2},
+        {-0.75, 0.1, 3e-3, 2},
+        {-0.743, 0.131, 3e-3, 2},
+        {-1.25, 0.02, 3e-3, 2},
+        {-0.1, 0.9, 3e-3, 2},
+        {0, 0, DEFAULT_SCALE, 3},
+        {-0.2, 0.6, 3e-3, 5},
+    };
+    bool ok = true;
+    for (const auto &p : views) {
+        view v;
+        v.x_center = p.x;
+        v.y_center = p.y;
+        v.scale = p.scale;
+        v.power = p.power;
+        v.width = 480;
+        v.height = 270;
+        v.max_steps = max_steps_for(v.scale);
+        row_kernel single = select_float_kernel(v.power);
+        if (!single || !single_precision(v)) {
+            std::printf("float kernels: (%g, %g) scale %g power %g: skipped, not a float view\n",
+                        p.x, p.y, p.scale, p.power);
+            continue;
+        }
+        std::vector<std::uint16_t> a = render_rows(v, single);
+        std::vector<std::uint16_t> b = render_rows(v, select_row_kernel(v.power));
+        size_t mismatched = 0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            mismatched += a[i] != b[i];
+        }
+        double fraction = static_cast<double>(mismatched) / static_cast<double>(a.size());
+        bool passed = fraction <= MAX_FLOAT_MISMATCH;
+        std::printf("float kernels: (%g, %g) scale %g power %g: %.4f%% pixels differ: %s\n",
+                    p.x, p.y, p.scale, p.power, 100 * fraction, passed ? "ok" : "FAIL");
+        ok &= passed;
+    }
+    return ok;
+}
+
+// Колесо в окне: несколько щелчков внутрь и столько же обратно, каждый кадр
+// по плану планировщика, как на медленной машине, где кадры по вводу урезают
+// предел итераций. Вернувшийся кадр целиком собирается из кеша
+static bool check_cache_round_trip() {
+    view v;
+    v.width = 480;
+    v.height = 270;
+    size_t pixels = v.width * v.height;
+    std::vector<std::uint16_t> steps(pixels);
+    tile_cache cache(256 << 20);
+    render_options options;
+    options.cache = &cache;
+    frame_scheduler scheduler;
+    tile_queue::load_stats slow;
+    slow.first_samples = 1000;
+    slow.first_pass = std::chrono::seconds(1);
+
+    auto frame = [&](bool interactive) {
+        frame_scheduler::plan plan = scheduler.next(v.scale, pixels, interactive, interactive ? slow : tile_queue::load_stats());
+        v.max_steps = plan.max_steps;
+        options.first_precision = plan.first_precision;
+        render_stats stats = render(v, options, frame_buffer{nullptr, 0, steps.data()}, 1);
+        scheduler.observe(steps.data(), pixels);
+        return stats;
+    };
+
+    const int CLICKS = 3;
+    frame(false);
+    unsigned start_steps = v.max_steps;
+    for (int i = 0; i < CLICKS; ++i) {
+        v.scale *= 0.8;
+        frame(true);
+    }
+    render_stats back;
+    for (int i = 0; i < CLICKS; ++i) {
+        v.scale /= 0.8;
+        back = frame(true);
+    }
+    bool passed = back.samples == 0;
+    std::printf("cache round trip: %d clicks in and out, %u then %u steps: %llu points recomputed: %s\n",
+                CLICKS, start_steps, v.max_steps, static_cast<unsigned long long>(back.samples),
+                passed ? "ok" : "FAIL");
+    return passed;
+}
+
+int main() {
+    bool ok = true;
+    ok &= check_float_kernels();
+    ok &= check_cache_round_trip();
+    return ok ? 0 : 1;
+}
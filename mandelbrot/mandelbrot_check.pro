@@ -0,0 +1,13 @@
+# Проверки движка без Qt: qmake mandelbrot_check.pro && make && ./mandelbrot_check
+
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+LIBS += -pthread
+QMAKE_CXXFLAGS += -pthread
+
+include(engine.pri)
+
+SOURCES += \
+    mandelbrot_check.cpp
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "animation.h"
+#include "double_double.h"
+#include "image_io.h"
+#include "renderer.h"
+
+// Консольная версия: рисует один кадр в файл и печатает скорость.
+// mandelbrot_cli [--center X Y] [--scale S] [--power P] [--size W H]
+//                [--max-steps N] [--threads N] [--no-subdivide] [--palette NAME]
+//                [--contrast C] [--antialias] [--output FILE]
+//                [--path FILE [--in-flight N] [--key-zoom R]]
+// Без --max-steps предел итераций выбирается по масштабу, как в окне.
+// С --path рисует зум по ключевым точкам из файла (animation.h) в файлы с
+// номерами кадров вместо # в --output и печатает кадры в секунду.
+
+// Десятичная запись в двойной-двойной точности: для глубокого зума центру
+// нужно больше знаков, чем сохраняет atof
+static double_double parse_decimal(const char *text) {
+    const char *p = text;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        ++p;
+    }
+    double_double value;
+    int exponent = 0;
+    bool fraction = false;
+    for (; *p; ++p) {
+        if (*p >= '0' && *p <= '9') {
+            value = value * 10. + static_cast<double>(*p - '0');
+            exponent -= fraction;
+        } else if (*p == '.' && !fraction) {
+            fraction = true;
+        } else {
+            if (*p == 'e' || *p == 'E') {
+                exponent += std::atoi(p + 1);
+            }
+            break;
+        }
+    }
+    double_double power_of_ten = 1.;
+    for (int i = 0; i < std::abs(exponent); ++i) {
+        power_of_ten *= 10.;
+    }
+    value = exponent < 0 ? value / power_of_ten : value * power_of_ten;
+    return negative ? -value : value;
+}
+
+// Ключевые точки пути: по строке "кадр x y масштаб [степень]", # -- комментарий
+static std::vector<keyframe> read_path(const std::string &file) {
+    std::ifstream in(file);
+    if (!in) {
+        throw std::runtime_error("cannot open " + file);
+    }
+    std::vector<keyframe> path;
+    std::string line;
+    for (size_t n = 1; std::getline(in, line); ++n) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string x;
+        std::string y;
+        keyframe k;
+        if (!(fields >> k.frame)) {
+            continue;
+        }
+        if (!(fields >> x >> y >> k.scale) || !(k.scale > 0)
+                || (!path.empty() && k.frame <= path.back().frame)) {
+            throw std::runtime_error(file + ":" + std::to_string(n) + ": expected increasing frame, x, y,"
+                                     " positive scale and optional power");
+        }
+        fields >> k.power;
+        k.x_center = parse_decimal(x.c_str());
+        k.y_center = parse_decimal(y.c_str());
+        path.push_back(k);
+    }
+    if (path.empty()) {
+        throw std::runtime_error(file + ": no keyframes");
+    }
+    return path;
+}
+
+// Имя файла кадра: последняя группа # в pattern -- номер с нулями впереди
+static std::string frame_name(const std::string &pattern, size_t frame) {
+    size_t last = pattern.rfind('#');
+    if (last == std::string::npos) {
+        return pattern;
+    }
+    size_t first = pattern.find_last_not_of('#', last);
+    first = first == std::string::npos ? 0 : first + 1;
+    std::string number = std::to_string(frame);
+    if (number.size() < last + 1 - first) {
+        number.insert(0, last + 1 - first - number.size(), '0');
+    }
+    return pattern.substr(0, first) + number + pattern.substr(last + 1);
+}
+
+static void usage(const char *name) {
+    std::fprintf(stderr, "usage: %s [--center X Y] [--scale S] [--power P] [--size W H] [--max-steps N]"
+                         " [--threads N] [--no-subdivide] [--palette NAME] [--contrast C]"
+                         " [--antialias] [--output FILE.ppm|FILE.png]"
+                         " [--path FILE [--in-flight N] [--key-zoom R]]\n", name);
+    std::fprintf(stderr, "palettes:");
+    for (const palette::preset &p : palette::presets()) {
+        std::fprintf(stderr, " %s", p.name);
+    }
+    std::fprintf(stderr, "\n");
+    std::exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    view v;
+    v.width = 1920;
+    v.height = 1080;
+    size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string output;
+    std::string path_file;
+    size_t in_flight = 0;
+    double key_zoom = animation_options().key_zoom;
+    render_options options;
+    options.first_precision = 1;
+    palette::coloring coloring = palette::classic;
+    double contrast = 1;
+    unsigned max_steps = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        auto has = [&](int n) {
+            if (i + n >= argc) {
+                usage(argv[0]);
+            }
+            return true;
+        };
+        if (!std::strcmp(argv[i], "--center") && has(2)) {
+            double_double x = parse_decimal(argv[++i]);
+            double_double y = parse_decimal(argv[++i]);
+            v.x_center = x.hi;
+            v.x_center_lo = x.lo;
+            v.y_center = y.hi;
+            v.y_center_lo = y.lo;
+        } else if (!std::strcmp(argv[i], "--scale") && has(1)) {
+            v.scale = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--power") && has(1)) {
+            v.power = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--size") && has(2)) {
+            v.width = std::strtoul(argv[++i], nullptr, 10);
+            v.height = std::strtoul(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--max-steps") && has(1)) {
+            max_steps = std::min<unsigned long>(STEPS_LIMIT, std::strtoul(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--threads") && has(1)) {
+            n_threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--no-subdivide")) {
+            options.subdivide = false;
+        } else if (!std::strcmp(argv[i], "--palette") && has(1)) {
+            const char *name = argv[++i];
+            auto &presets = palette::presets();
+            auto it = std::find_if(presets.begin(), presets.end(),
+                                   [&](const palette::preset &p) { return !std::strcmp(p.name, name); });
+            if (it == presets.end()) {
+                usage(argv[0]);
+            }
+            coloring = it->f;
+        } else if (!std::strcmp(argv[i], "--contrast") && has(1)) {
+            contrast = std::atof(argv[++i]);
+            if (!(contrast > 0)) {
+                usage(argv[0]);
+            }
+        } else if (!std::strcmp(argv[i], "--antialias")) {
+            options.antialias = true;
+        } else if (!std::strcmp(argv[i], "--output") && has(1)) {
+            output = argv[++i];
+        } else if (!std::strcmp(argv[i], "--path") && has(1)) {
+            path_file = argv[++i];
+        } else if (!std::strcmp(argv[i], "--in-flight") && has(1)) {
+            in_flight = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--key-zoom") && has(1)) {
+            key_zoom = std::atof(argv[++i]);
+            if (!(key_zoom >= 1)) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (!path_file.empty()) {
+        animation_options batch;
+        batch.width = v.width;
+        batch.height = v.height;
+        batch.max_steps = max_steps;
+        batch.subdivide = options.subdivide;
+        batch.antialias = options.antialias;
+        batch.coloring = coloring;
+        batch.contrast = contrast;
+        batch.n_threads = n_threads;
+        // по умолчанию по кадру на пару потоков: одному кадру не хватает работы
+        // на все потоки в его хвосте
+        batch.in_flight = in_flight > 0 ? in_flight : std::max<size_t>(1, n_threads / 2);
+        batch.key_zoom = key_zoom;
+        std::string pattern = output.empty() ? "frame#####.ppm" : output;
+        try {
+            std::vector<keyframe> path = read_path(path_file);
+            auto start = std::chrono::steady_clock::now();
+            animation_stats total = render_animation(path, batch, [&](size_t frame, const unsigned char *data) {
+                write_image(frame_name(pattern, frame), data, batch.width, batch.height, 3 * batch.width);
+            });
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::printf("%zu frames (%zu key images) %zux%zu, %zu threads, %zu in flight: %.1f s, %.2f frames/s\n",
+                        total.frames, total.keys, batch.width, batch.height, n_threads,
+                        batch.in_flight, seconds, total.frames / seconds);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+    if (output.empty()) {
+        output = "mandelbrot.ppm";
+    }
+    v.max_steps = max_steps > 0 ? max_steps : max_steps_for(v.scale);
+    palette colors(coloring, v.max_steps, contrast);
+    options.colors = &colors;
+    std::vector<unsigned char> pixels(3 * v.width * v.height);
+    tile_queue::load_stats load;
+    auto start = std::chrono::steady_clock::now();
+    render_stats stats = render(v, options, {pixels.data(), 3 * v.width}, n_threads, &load);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    try {
+        write_image(output, pixels.data(), v.width, v.height, 3 * v.width);
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    double max_busy = 0;
+    double total_busy = 0;
+    for (auto busy : load.busy) {
+        double ms = std::chrono::duration<double, std::milli>(busy).count();
+        max_busy = std::max(max_busy, ms);
+        total_busy += ms;
+    }
+    std::printf("%zux%zu, %zu threads: %.1f ms, %.1f Mpixel/s, %.1f Miter/s, balance %.2f\n",
+                v.width, v.height, n_threads, seconds * 1e3,
+                v.width * v.height / seconds / 1e6, stats.iterations / seconds / 1e6,
+                max_busy > 0 ? total_busy / max_busy / load.busy.size() : 1.);
+    return 0;
+}
@@ -0,0 +1,17 @@
+# Консольная версия без Qt: qmake mandelbrot_cli.pro && make
+
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+LIBS += -pthread
+QMAKE_CXXFLAGS += -pthread
+
+include(engine.pri)
+
+SOURCES += \
+    image_io.cpp \
+    mandelbrot_cli.cpp
+
+HEADERS += \
+    image_io.h
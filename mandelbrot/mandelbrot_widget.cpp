@@ -1,29 +1,79 @@
 #include "mandelbrot_widget.h"
 #include "mainwindow.h"
+#include <cmath>
 #include <complex>
+#include <cstdlib>
+#include <cstring>
 #include <QImage>
 #include <QPainter>
 #include <QWheelEvent>
 #include <QDrag>
 
-mandelbrot_widget::mandelbrot_widget(QWidget *parent) : QWidget(parent) {
+// Сдвиг картинки w x h с pixel байтами на пиксель
+static void shift_pixels(unsigned char *data, size_t stride, size_t pixel, int w, int h, int dx, int dy) {
+    size_t bytes = pixel * (w - std::abs(dx));
+    int src_x = std::max(0, -dx);
+    int dst_x = std::max(0, dx);
+    // строки копируются в порядке, не затирающем еще не скопированные
+    for (int i = 0; i < h - std::abs(dy); ++i) {
+        int y = dy > 0 ? h - 1 - i : i;
+        memmove(data + y * stride + pixel * dst_x, data + (y - dy) * stride + pixel * src_x, bytes);
+    }
+}
+
+// лимит кеша тайлов в мегабайтах можно задать через MANDELBROT_CACHE_MB
+static size_t cache_limit(size_t default_mb) {
+    const char *mb = std::getenv("MANDELBROT_CACHE_MB");
+    return (mb ? std::strtoull(mb, nullptr, 10) : default_mb) << 20;
+}
+
+mandelbrot_widget::mandelbrot_widget(QWidget *parent) : QWidget(parent), cache(cache_limit(DEFAULT_CACHE_MB)) {
     for (size_t i = 0; i < worker::N_THREADS; ++i) {
         worker_objs.emplace_back(std::make_unique<worker>());
         worker_threads.emplace_back(std::make_unique<QThread>());
         worker_objs[i]->moveToThread(worker_threads[i].get());
         worker_objs[i]->set_id(i);
         worker_objs[i]->set_mutex(&mutex_);
+        worker_objs[i]->set_queue(&queue);
+        worker_objs[i]->set_cache(&cache);
+        worker_objs[i]->set_palette(&colors);
+        worker_objs[i]->set_damage(&damage);
+        worker_objs[i]->set_jobs(&jobs);
         connect(worker_objs[i].get(), &worker::calculation_finished, this, &mandelbrot_widget::calculation_finished);
         connect(this, &mandelbrot_widget::calculate, worker_objs[i].get(), &worker::calculate);
         worker_threads[i]->start();
     }
 
+    idle_timer.setSingleShot(true);
+    idle_timer.setInterval(IDLE_MS);
+    // ввод затих: кадр пересчитывается, если он урезан или предел итераций
+    // по нему сдвинулся; недосчитанного кадра ждем дальше
+    connect(&idle_timer, &QTimer::timeout, this, [this] {
+        bool refine;
+        {
+            std::lock_guard guard(mutex_);
+            if (!queue.stats().done) {
+                idle_timer.start();
+                return;
+            }
+            scheduler.observe(buffers.work().steps, buffers.width() * buffers.height());
+            refine = scheduler.refine(scale);
+        }
+        if (refine) {
+            start_frame(false);
+        }
+    });
+
+    repaint_timer.setSingleShot(true);
+    repaint_timer.setInterval(REPAINT_MS);
+    connect(&repaint_timer, &QTimer::timeout, this, &mandelbrot_widget::repaint_damage);
+
     QWidget::grabKeyboard();
 }
 
 mandelbrot_widget::~mandelbrot_widget() {
+    jobs.cancel();
     for (size_t i = 0; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->cancel();
         worker_threads[i]->exit();
         worker_threads[i]->wait();
     }
@@ -32,58 +82,57 @@ mandelbrot_widget::~mandelbrot_widget() {
 void mandelbrot_widget::paintEvent(QPaintEvent *event) {
     init_image();
     QPainter p(this);
-    p.drawImage(0, 0, *img_ptr.get());
+    p.drawImage(event->rect(), image, event->rect());
 }
 
 void mandelbrot_widget::set_power(double power) {
     init_image();
-    if (current_power != power) {
-        current_power = power;
-        size_t version = worker_objs[0]->set_power(current_power);
-        for (size_t i = 1; i < worker::N_THREADS; ++i) {
-            worker_objs[i]->set_power(current_power);
-        }
-        emit calculate(version);
+    if (this->power != power) {
+        this->power = power;
+        start_frame(true);
     }
 }
 
 void mandelbrot_widget::reset() {
     init_image();
-    size_t version = worker_objs[0]->reset();
-    for (size_t i = 1; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->reset();
+    x_center = 0;
+    y_center = 0;
+    scale = DEFAULT_SCALE;
+    start_frame(false);
+}
+
+// Потоки записали тайлы: перерисовка сразу, если последняя была больше
+// REPAINT_MS назад, иначе -- по таймеру. Пока накопленное не забрано, потоки
+// больше не зовут
+void mandelbrot_widget::calculation_finished() {
+    if (!repaint_timer.isActive()) {
+        repaint_damage();
     }
-    emit calculate(version);
 }
 
-void mandelbrot_widget::calculation_finished(std::shared_ptr<QImage> img_ptr) {
-    this->img_ptr = img_ptr;
-    update();
+void mandelbrot_widget::repaint_damage() {
+    tile_queue::rect r;
+    if (damage.take(r)) {
+        buffers.present(r, queue);
+        update(QRect(r.x, r.y, r.w, r.h));
+        repaint_timer.start();
+    }
 }
 
 void mandelbrot_widget::wheelEvent(QWheelEvent *event) {
     init_image();
     double numDegrees = static_cast<double>(event->angleDelta().y()) / 8;
     double numSteps = numDegrees / 15.0;
-    double scale = pow(0.8, numSteps);
-    double new_x = event->position().x();
-    double new_y = event->position().y();
-    size_t version = worker_objs[0]->set_center_and_scale(new_x, new_y, scale);
-    for (size_t i = 1; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->set_center_and_scale(new_x, new_y, scale);
-    }
-    emit calculate(version);
+    double factor = pow(0.8, numSteps);
+    zoom(event->position().x(), event->position().y(), factor);
+    start_frame(true);
 }
 
 void mandelbrot_widget::resizeEvent(QResizeEvent *event) {
     init_image();
     dragStartPosition = QPoint(width() / 2, height() / 2);
-    auto ptr = std::make_shared<QImage>(width(), height(), QImage::Format_RGB888);
-    size_t version = worker_objs[0]->set_input(ptr);
-    for (size_t i = 1; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->set_input(ptr);
-    }
-    emit calculate(version);
+    resize_buffers();
+    start_frame(true);
 }
 
 void mandelbrot_widget::keyPressEvent(QKeyEvent *event) {
@@ -110,14 +159,28 @@ void mandelbrot_widget::keyPressEvent(QKeyEvent *event) {
             move = QPoint(0, MOVE_LENGTH);
             break;
         }
+        // палитра и контраст: кадр только перекрашивается
+        case Qt::Key_C : {
+            recolor(palette_index + 1, contrast);
+            return;
+        }
+        case Qt::Key_BracketLeft : {
+            recolor(palette_index, contrast / CONTRAST_STEP);
+            return;
+        }
+        case Qt::Key_BracketRight : {
+            recolor(palette_index, contrast * CONTRAST_STEP);
+            return;
+        }
+        case Qt::Key_X : {
+            antialias = !antialias;
+            start_frame(false);
+            return;
+        }
         default : return;
     }
     dragStartPosition += move;
-    size_t version = worker_objs[0]->move_center(move.x(), move.y());
-    for (size_t i = 1; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->move_center(move.x(), move.y());
-    }
-    emit calculate(version);
+    pan(-move.x(), -move.y());
 }
 
 void mandelbrot_widget::mousePressEvent(QMouseEvent *event) {
@@ -133,20 +196,124 @@ void mandelbrot_widget::mouseMoveEvent(QMouseEvent *event) {
         return;
     QPoint delta = event->pos() - dragStartPosition;
     dragStartPosition = event->pos();
-    size_t version = worker_objs[0]->move_center(-delta.x(), -delta.y());
-    for (size_t i = 1; i < worker::N_THREADS; ++i) {
-        worker_objs[i]->move_center(-delta.x(), -delta.y());
+    pan(delta.x(), delta.y());
+}
+
+// Сдвигает картинку на (dx, dy) пикселей, досчитывать нужно только открывшиеся полосы
+void mandelbrot_widget::pan(int dx, int dy) {
+    // по сетке пикселей, чтобы уже посчитанную картинку можно было просто сдвинуть
+    x_center -= dx * scale;
+    y_center -= dy * scale;
+    size_t version = publish();
+    {
+        std::lock_guard guard(mutex_);
+        int w = buffers.width();
+        int h = buffers.height();
+        if (queue.shift(version, w, h, dx, dy)) {
+            frame_buffer out = buffers.work();
+            shift_pixels(out.data, out.stride, 3, w, h, dx, dy);
+            shift_pixels(reinterpret_cast<unsigned char *>(out.steps), w * sizeof(std::uint16_t),
+                         sizeof(std::uint16_t), w, h, dx, dy);
+            // сдвинутое показывается целиком; открывшиеся полосы -- пока старые пиксели
+            buffers.present({0, 0, buffers.width(), buffers.height()}, queue);
+            update();
+        }
     }
+    idle_timer.start();
     emit calculate(version);
 }
 
+// Новая палитра: готовые пиксели перекрашиваются из буфера итераций,
+// еще не готовые тайлы потоки раскрасят уже ей
+void mandelbrot_widget::recolor(size_t index, double contrast) {
+    palette_index = index % palette::presets().size();
+    this->contrast = contrast;
+    {
+        std::lock_guard guard(mutex_);
+        colors = palette(palette::presets()[palette_index].f, plan.max_steps, contrast);
+        size_t w = buffers.width();
+        frame_buffer out = buffers.work();
+        colors.colorize(out.steps, w, w, buffers.height(), out.data, out.stride);
+        buffers.present({0, 0, w, buffers.height()}, queue);
+    }
+    update();
+}
+
 void mandelbrot_widget::init_image() {
-    if (img_ptr.get() == nullptr) {
-        auto ptr = std::shared_ptr<QImage>(new QImage(width(), height(), QImage::Format_RGB888));
-        size_t version = worker_objs[0]->set_input(ptr);
-        for (size_t i = 1; i < worker::N_THREADS; ++i) {
-            worker_objs[i]->set_input(ptr);
+    if (image.isNull()) {
+        resize_buffers();
+        start_frame(false);
+    }
+}
+
+// Буферы по размеру окна; потоки получат их со следующим заданием. Кадр сначала
+// отменяется: после исключительной блокировки он в прежние указатели уже не пишет
+void mandelbrot_widget::resize_buffers() {
+    jobs.cancel();
+    std::lock_guard guard(mutex_);
+    buffers.resize(width(), height());
+    image = QImage(buffers.display(), width(), height(), buffers.stride(), QImage::Format_RGB888);
+}
+
+// Сдвигает центр к точке окна (new_x, new_y) при изменении масштаба в factor раз
+void mandelbrot_widget::zoom(double new_x, double new_y, double factor) {
+    double old_scale = scale;
+    scale *= factor;
+    double delta_x;
+    double delta_y;
+    size_t w = buffers.width();
+    size_t h = buffers.height();
+
+    if (factor <= 1) {
+        delta_x = new_x - w / 2;
+        delta_y = -(new_y - h / 2);
+    } else {
+        delta_x = -(new_x - w / 2);
+        delta_y = new_y - h / 2;
+    }
+    double delta_r = abs(hypot(delta_x, delta_y));
+    double cos_a = delta_x / delta_r;
+    double sin_a = delta_y / delta_r;
+    if (factor <= 1) {
+        x_center += delta_r * (1 - factor) * cos_a * old_scale;
+        y_center -= delta_r * (1 - factor) * sin_a * old_scale;
+    } else {
+        x_center -= delta_r * (1 - factor) * cos_a * old_scale;
+        y_center += delta_r * (1 - factor) * sin_a * old_scale;
+    }
+}
+
+// Текущий вид, план и рабочий буфер -- одним заданием для всех потоков
+size_t mandelbrot_widget::publish() {
+    render_job job;
+    job.v = {x_center.hi, y_center.hi, scale, power, buffers.width(), buffers.height(),
+             x_center.lo, y_center.lo, plan.max_steps};
+    job.first_precision = plan.first_precision;
+    job.antialias = antialias;
+    job.out = buffers.work();
+    return jobs.publish(job);
+}
+
+// План кадра по бюджету времени и новое задание для всех потоков. Тайлы пишутся
+// под разделяемой блокировкой, поэтому после исключительной старый кадр уже
+// ничего не запишет поверх нового
+void mandelbrot_widget::start_frame(bool interactive) {
+    size_t version;
+    {
+        std::lock_guard guard(mutex_);
+        tile_queue::load_stats last = queue.stats();
+        size_t pixels = buffers.width() * buffers.height();
+        if (last.done) {
+            scheduler.observe(buffers.work().steps, pixels);
         }
-        emit calculate(version);
+        frame_scheduler::plan next = scheduler.next(scale, pixels, interactive, last);
+        // таблица палитры -- на предел итераций кадра
+        if (next.max_steps != plan.max_steps) {
+            colors = palette(palette::presets()[palette_index].f, next.max_steps, contrast);
+        }
+        plan = next;
+        version = publish();
     }
+    idle_timer.start();
+    emit calculate(version);
 }
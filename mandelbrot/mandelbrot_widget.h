@@ -1,9 +1,20 @@
 #include <QWidget>
 #include <QThread>
 #include <QGraphicsView>
+#include <QTimer>
+#include <QImage>
 #include <vector>
 #include <memory>
+#include <shared_mutex>
+#include "damage_tracker.h"
+#include "frame_buffers.h"
+#include "frame_scheduler.h"
+#include "double_double.h"
+#include "palette.h"
+#include "render_job.h"
 #include "worker.h"
+#include "tile_cache.h"
+#include "tile_queue.h"
 
 #pragma once
 
@@ -18,7 +29,7 @@ public:
     void set_power(double power);
 
 public slots:
-            void calculation_finished(std::shared_ptr<QImage> img_ptr);
+            void calculation_finished();
     void reset();
 
     signals:
@@ -33,15 +44,43 @@ protected:
 
 private:
     void init_image();
+    void resize_buffers();
+    void zoom(double new_x, double new_y, double factor);
+    size_t publish();
+    void start_frame(bool interactive);
+    void pan(int dx, int dy);
+    void recolor(size_t index, double contrast);
+    void repaint_damage();
 
     const static int MOVE_LENGTH{50};
+    const static size_t DEFAULT_CACHE_MB{256};
+    constexpr static double CONTRAST_STEP{1.25};
+    const static int IDLE_MS{250};  // столько без ввода -- и урезанный кадр пересчитывается
+    const static int REPAINT_MS{16};  // перерисовки по готовым тайлам -- не чаще
 
-    std::shared_ptr<QImage> img_ptr{};
-    double current_power{0};
+    frame_buffers buffers;
+    QImage image{};  // над показываемым буфером
+    // вид; его меняет только поток окна, потоки рендера видят опубликованные задания
+    double scale{DEFAULT_SCALE};
+    double_double x_center{0};  // с глубоким зумом double не хватает
+    double_double y_center{0};
+    double power{2};
+    frame_scheduler::plan plan;
+    size_t palette_index{0};
+    double contrast{1};
+    bool antialias{false};
     QPoint dragStartPosition{};
 
     std::vector<std::unique_ptr<QThread>> worker_threads;
     std::vector<std::unique_ptr<worker>> worker_objs;
 
-    std::mutex mutex_{};
+    std::shared_mutex mutex_{};  // публикация тайлов; исключительно -- смена кадра
+    job_board jobs;
+    tile_queue queue{worker::N_THREADS};
+    tile_cache cache;
+    frame_scheduler scheduler;
+    QTimer idle_timer;
+    damage_tracker damage;
+    QTimer repaint_timer;
+    palette colors{palette::classic, MAX_STEPS};  // под mutex_, как и картинка; для plan.max_steps
 };
@@ -0,0 +1,64 @@
+#include "palette.h"
+#include <algorithm>
+#include <cmath>
+
+palette::rgb palette::classic(double s) {
+    // (1 - s) * 200 * 255 не влезает в unsigned char, оборачивание дает полосы палитры
+    auto green = static_cast<unsigned char>(static_cast<int>((1 - s) * 200 * 255));
+    if (green == 0) {
+        return {0, 0, 0};
+    }
+    return {80, green, 120};
+}
+
+palette::rgb palette::grayscale(double s) {
+    auto v = static_cast<unsigned char>(255 * (1 - s));
+    return {v, v, v};
+}
+
+palette::rgb palette::fire(double s) {
+    auto channel = [s](double from) {
+        return static_cast<unsigned char>(255 * std::clamp(3 * s - from, 0., 1.));
+    };
+    return {channel(0), channel(1), channel(2)};
+}
+
+const std::vector<palette::preset> &palette::presets() {
+    static const std::vector<preset> all{{"classic", classic}, {"grayscale", grayscale}, {"fire", fire}};
+    return all;
+}
+
+palette::palette(coloring f, unsigned max_steps, double contrast)
+        : max_steps(max_steps), table(3 * (max_steps + 1)) {
+    for (unsigned steps = 0; steps < max_steps; ++steps) {
+        rgb c = f(std::pow(1. * steps / max_steps, 1 / contrast));
+        std::copy(c.begin(), c.end(), table.begin() + 3 * steps);
+    }
+}
+
+void palette::colorize(const std::uint16_t *steps, size_t steps_stride, size_t w, size_t h,
+                       unsigned char *data, size_t stride) const {
+    for (size_t y = 0; y < h; ++y) {
+        const std::uint16_t *row = steps + y * steps_stride;
+        unsigned char *p = data + y * stride;
+        for (size_t x = 0; x < w; ++x) {
+            const unsigned char *c = color(row[x]);
+            *p++ = c[0];
+            *p++ = c[1];
+            *p++ = c[2];
+        }
+    }
+}
+
+void palette::blend(const std::uint16_t *steps, size_t n, unsigned char *pixel) const {
+    unsigned sum[3]{};
+    for (size_t i = 0; i < n; ++i) {
+        const unsigned char *c = color(steps[i]);
+        for (size_t k = 0; k < 3; ++k) {
+            sum[k] += c[k];
+        }
+    }
+    for (size_t k = 0; k < 3; ++k) {
+        pixel[k] = static_cast<unsigned char>((sum[k] + n / 2) / n);
+    }
+}
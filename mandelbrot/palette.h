@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Раскраска чисел итераций. Цвет зависит только от числа итераций, поэтому
+// считается заранее для каждого из max_steps + 1 значений, а смена палитры
+// или контраста -- один проход по буферу итераций кадра, без пересчета.
+class palette {
+public:
+    using rgb = std::array<unsigned char, 3>;
+    // цвет по доле s = steps / max_steps, 0 <= s < 1; не вышедшие точки черные
+    using coloring = rgb (*)(double s);
+
+    struct preset {
+        const char *name;
+        coloring f;
+    };
+
+    static rgb classic(double s);
+    static rgb grayscale(double s);
+    static rgb fire(double s);
+
+    // Все палитры по именам, первая -- classic
+    static const std::vector<preset> &presets();
+
+    // contrast > 1 растягивает быстро вышедшие точки, < 1 -- долго жившие
+    palette(coloring f, unsigned max_steps, double contrast = 1);
+
+    const unsigned char *color(unsigned steps) const {
+        return &table[3 * (steps < max_steps ? steps : max_steps)];
+    }
+
+    // Средний цвет n отсчетов внутри одного пикселя
+    void blend(const std::uint16_t *steps, size_t n, unsigned char *pixel) const;
+
+    // w x h пикселей: steps_stride чисел итераций и stride байт RGB на строку
+    void colorize(const std::uint16_t *steps, size_t steps_stride, size_t w, size_t h,
+                  unsigned char *data, size_t stride) const;
+
+private:
+    unsigned max_steps;
+    std::vector<unsigned char> table;  // 3 байта на число итераций
+};
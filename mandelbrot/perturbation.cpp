@@ -0,0 +1,126 @@
+#include "perturbation.h"
+#include <algorithm>
+#include <cmath>
+#include "kernel.h"
+
+bool reference_orbit::supports(double power) {
+    return power >= 2 && power <= MAX_INTEGER_POWER && power == std::floor(power);
+}
+
+reference_orbit::reference_orbit(double_double re, double_double im, unsigned power, unsigned max_steps)
+        : power(power) {
+    double_double xr;
+    double_double xi;
+    for (unsigned n = 0;; ++n) {
+        zr.push_back(static_cast<double>(xr));
+        zi.push_back(static_cast<double>(xi));
+        if (n == max_steps || zr.back() * zr.back() + zi.back() * zi.back() >= 4.) {
+            break;
+        }
+        double_double pr = xr;
+        double_double pi = xi;
+        for (unsigned k = 1; k < power; ++k) {
+            double_double t = pr * xr - pi * xi;
+            pi = pr * xi + pi * xr;
+            pr = t;
+        }
+        xr = pr + re;
+        xi = pi + im;
+    }
+
+    if (power != 2) {
+        return;
+    }
+    // A_{n+1} = 2 Z_n A_n + 1, B_{n+1} = 2 Z_n B_n + A_n^2, C_{n+1} = 2 Z_n C_n + 2 A_n B_n
+    series.push_back({0, 0, 0, 0, 0, 0});
+    for (size_t n = 0; n + 1 < zr.size(); ++n) {
+        const series_terms &s = series.back();
+        double z2r = 2 * zr[n];
+        double z2i = 2 * zi[n];
+        series.push_back({z2r * s.ar - z2i * s.ai + 1,
+                          z2r * s.ai + z2i * s.ar,
+                          z2r * s.br - z2i * s.bi + s.ar * s.ar - s.ai * s.ai,
+                          z2r * s.bi + z2i * s.br + 2 * s.ar * s.ai,
+                          z2r * s.cr - z2i * s.ci + 2 * (s.ar * s.br - s.ai * s.bi),
+                          z2r * s.ci + z2i * s.cr + 2 * (s.ar * s.bi + s.ai * s.br)});
+    }
+}
+
+size_t reference_orbit::series_skip(double radius) const {
+    size_t n = 0;
+    // с конца орбиты отсчет все равно переносится на начало
+    while (n + 2 < series.size()) {
+        const series_terms &s = series[n + 1];
+        double a = std::hypot(s.ar, s.ai);
+        double c = std::hypot(s.cr, s.ci);
+        if (!(c * radius * radius <= SERIES_TOLERANCE * a)) {
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+void reference_orbit::iterate(double re, double re_step, double im, double im_step, size_t count,
+                              unsigned max_steps, std::uint16_t *steps) const {
+    size_t last = zr.size() - 1;
+    // |dc| на отрезке выпукла, наибольшая -- на одном из концов
+    double radius = std::max(std::hypot(re, im), std::hypot(re + (count - 1) * re_step,
+                                                            im + (count - 1) * im_step));
+    size_t skip = std::min<size_t>(series_skip(radius), max_steps);
+    for (size_t i = 0; i < count; ++i) {
+        double cr = re + i * re_step;
+        double ci = im + i * im_step;
+        double dr = 0;
+        double di = 0;
+        if (skip > 0) {
+            const series_terms &s = series[skip];
+            double c2r = cr * cr - ci * ci;
+            double c2i = 2 * cr * ci;
+            double c3r = c2r * cr - c2i * ci;
+            double c3i = c2r * ci + c2i * cr;
+            dr = s.ar * cr - s.ai * ci + s.br * c2r - s.bi * c2i + s.cr * c3r - s.ci * c3i;
+            di = s.ar * ci + s.ai * cr + s.br * c2i + s.bi * c2r + s.cr * c3i + s.ci * c3r;
+        }
+        size_t m = skip;
+        unsigned n = skip;
+        // ряд не видит выхода из круга: вышедший раньше отсчет считается с начала
+        if (skip > 0 && (zr[m] + dr) * (zr[m] + dr) + (zi[m] + di) * (zi[m] + di) >= 4.) {
+            dr = 0;
+            di = 0;
+            m = 0;
+            n = 0;
+        }
+        for (; n < max_steps; ++n, ++m) {
+            // z = Z + d
+            double xr = zr[m] + dr;
+            double xi = zi[m] + di;
+            double norm = xr * xr + xi * xi;
+            if (norm >= 4.) {
+                break;
+            }
+            if (norm < dr * dr + di * di || m == last) {
+                dr = xr;
+                di = xi;
+                m = 0;
+            }
+            // (Z + d)^p - Z^p = d * sum_{k < p} (Z + d)^k Z^(p-1-k)
+            double sr = 1;
+            double si = 0;
+            double br = 1;
+            double bi = 0;
+            for (unsigned k = 1; k < power; ++k) {
+                double t = br * zr[m] - bi * zi[m];
+                bi = br * zi[m] + bi * zr[m];
+                br = t;
+                t = sr * xr - si * xi + br;
+                si = sr * xi + si * xr + bi;
+                sr = t;
+            }
+            double t = dr * sr - di * si + cr;
+            di = dr * si + di * sr + ci;
+            dr = t;
+        }
+        steps[i] = static_cast<std::uint16_t>(n);
+    }
+}
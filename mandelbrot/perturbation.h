@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "double_double.h"
+
+// Глубокий зум по теории возмущений. Опорная орбита Z_n одной точки C
+// считается в двойной-двойной точности, остальные точки c = C + dc -- как
+// отклонения d_n = z_n - Z_n в обычном double:
+//     d_{n+1} = (Z_n + d_n)^p - Z_n^p + dc,
+// где d и dc малы и double их не теряет, сколь бы мал ни был пиксель.
+// Для p = 2 первые итерации пропускаются по ряду
+// d_n = A_n dc + B_n dc^2 + C_n dc^3, пока отброшенные члены пренебрежимы.
+// Глитч -- z_n ближе к нулю, чем к Z_n: тогда d_n теряет точность. Такой
+// отсчет (и отсчет, дошедший до конца опорной орбиты) продолжается с начала
+// орбиты: d = z, n опорной орбиты = 0, так что второй опорной точки не нужно.
+class reference_orbit {
+public:
+    // только целые степени 2..MAX_INTEGER_POWER
+    static bool supports(double power);
+
+    reference_orbit(double_double re, double_double im, unsigned power, unsigned max_steps);
+
+    // То же, что row_kernel, но re и im -- отклонения dc от опорной точки
+    void iterate(double re, double re_step, double im, double im_step, size_t count,
+                 unsigned max_steps, std::uint16_t *steps) const;
+
+private:
+    // отброшенный член ряда относительно первого
+    constexpr static double SERIES_TOLERANCE = 1e-12;
+
+    struct series_terms {
+        double ar;
+        double ai;
+        double br;
+        double bi;
+        double cr;
+        double ci;
+    };
+
+    // Сколько итераций можно пропустить по ряду при |dc| <= radius
+    size_t series_skip(double radius) const;
+
+    unsigned power;
+    std::vector<double> zr;  // Z_n в double; последняя -- вышедшая из круга или n = max_steps
+    std::vector<double> zi;
+    std::vector<series_terms> series;  // A_n, B_n, C_n, только для p = 2
+};
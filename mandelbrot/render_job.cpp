@@ -0,0 +1,25 @@
+#include "render_job.h"
+
+size_t job_board::publish(render_job job) {
+    job.version = version.load() + 1;
+    // сначала задание, потом версия: получивший версию найдет и задание
+    std::atomic_store(&this->job, std::make_shared<const render_job>(job));
+    version.store(job.version);
+    return job.version;
+}
+
+void job_board::cancel() {
+    ++version;
+}
+
+std::shared_ptr<const render_job> job_board::take(size_t version) const {
+    std::shared_ptr<const render_job> current = std::atomic_load(&job);
+    if (!current || current->version != version || this->version.load() != version) {
+        return nullptr;
+    }
+    return current;
+}
+
+cancel_flag job_board::cancelled(size_t version) const {
+    return {&this->version, version};
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include "renderer.h"
+
+// Кадр, который считают потоки окна: вид, первый проход и буфер. После
+// публикации не меняется, так что все потоки видят одни и те же параметры
+struct render_job {
+    size_t version{0};
+    view v;
+    size_t first_precision{FIRST_PRECISION};
+    bool antialias{false};
+    frame_buffer out{nullptr, 0};
+};
+
+// Последний опубликованный кадр. Окно публикует его одним атомарным указателем
+// и одной новой версией, сколько бы ни было потоков; поток забирает задание
+// сам, получив версию, и бросает его, как только версия сменится.
+// Публикует и отменяет один поток -- окна
+class job_board {
+public:
+    // Новая версия -- job.version; ее и рассылать потокам
+    size_t publish(render_job job);
+
+    // Отменяет текущий кадр, не публикуя нового
+    void cancel();
+
+    // Задание версии version; nullptr -- оно уже устарело
+    std::shared_ptr<const render_job> take(size_t version) const;
+
+    cancel_flag cancelled(size_t version) const;
+
+private:
+    std::atomic_size_t version{0};
+    std::shared_ptr<const render_job> job;  // только через std::atomic_load/atomic_store
+};
@@ -0,0 +1,501 @@
+#include "renderer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Буферы одного потока, чтобы не выделять память на каждый тайл
+struct render_scratch {
+    std::vector<std::uint16_t> pixels;
+    std::vector<std::uint16_t> steps;
+    std::vector<std::int64_t> columns;
+    std::vector<std::int64_t> rows;
+    std::vector<std::shared_ptr<const tile_cache::steps_t>> cached;
+    std::vector<std::uint16_t> framed;
+    std::vector<std::uint32_t> edges;
+    std::vector<std::uint16_t> subsamples;
+    std::vector<std::uint16_t> line;
+};
+
+// Отсчеты сглаживания в пикселе: повернутая решетка 2 x 2, смещения от центра в
+// долях пикселя. По каждой оси все четыре отсчета на разных местах, поэтому почти
+// горизонтальные и почти вертикальные границы сглаживаются не хуже, чем решеткой 4 x 4
+constexpr size_t SUBSAMPLES = 4;
+constexpr double SUBSAMPLE_OFFSETS[SUBSAMPLES][2] = {
+        {1. / 8, 3. / 8}, {3. / 8, -1. / 8}, {-1. / 8, -3. / 8}, {-3. / 8, 1. / 8}};
+
+// Сглаживается пиксель, число итераций которого отличается от соседа хотя бы на
+// EDGE_STEPS или который лежит по другую сторону границы множества. Соседние
+// числа итераций -- ступеньки плавного перехода палитры, таких границ больше
+// всего, а заметны они меньше всего
+constexpr unsigned EDGE_STEPS = 2;
+
+// Мьютексы клеток тайла и клеток, куда копируются его зеркальные строки. У
+// клеток бывает общий мьютекс, поэтому каждый берется один раз, и по
+// возрастанию адресов, чтобы два потока не ждали друг друга по кругу
+class cell_locks {
+public:
+    cell_locks(tile_queue &queue, const tile_queue::tile &t, const tile_queue::rect &copy) {
+        add(queue.tile_mutex(t));
+        if (copy.h > 0) {
+            add(queue.tile_mutex(copy.x, copy.y));
+            add(queue.tile_mutex(copy.x, copy.y + copy.h - 1));
+        }
+        for (size_t i = 0; i < n; ++i) {
+            locked[i]->lock();
+        }
+    }
+
+    ~cell_locks() {
+        for (size_t i = n; i-- > 0;) {
+            locked[i]->unlock();
+        }
+    }
+
+    cell_locks(const cell_locks &) = delete;
+    cell_locks &operator=(const cell_locks &) = delete;
+
+private:
+    // по порядку, без повторов
+    void add(std::mutex &m) {
+        std::mutex **end = locked.data() + n;
+        std::mutex **at = std::lower_bound(locked.data(), end, &m, std::less<std::mutex *>());
+        if (at == end || *at != &m) {
+            std::move_backward(at, end, end + 1);
+            *at = &m;
+            ++n;
+        }
+    }
+
+    std::array<std::mutex *, 3> locked{};
+    size_t n{0};
+};
+
+static std::int64_t floor_div(std::int64_t a, std::int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Уровень канонической сетки, ближайший к масштабу вида: пиксель вида
+// растягивается или сжимается не более чем в sqrt(2) раз
+static int cache_level(double scale) {
+    return static_cast<int>(std::lround(-std::log2(scale)));
+}
+
+unsigned max_steps_for(double scale) {
+    double steps = MAX_STEPS + STEPS_PER_OCTAVE * std::log2(DEFAULT_SCALE / scale);
+    return static_cast<unsigned>(std::clamp<double>(steps, MIN_STEPS, STEPS_LIMIT));
+}
+
+bool deep_zoom(const view &v) {
+    return v.scale < DEEP_ZOOM_SCALE && reference_orbit::supports(v.power);
+}
+
+// по уровням кеша, чтобы в одном уровне не смешивались float и double
+bool single_precision(const view &v) {
+    return cache_level(v.scale) <= cache_level(FLOAT_SCALE) && select_float_kernel(v.power);
+}
+
+tile_queue::mirror real_axis_mirror(const view &v) {
+    // точки глубокого зума -- отклонения от опорной орбиты, а она не симметрична
+    if (deep_zoom(v) || v.height < 2) {
+        return {};
+    }
+    // строка y лежит на (y - height / 2) * scale + y_center, так что строки y и
+    // axis - y симметричны, если 2 * y_center / scale -- целое
+    const double TOLERANCE = 1e-3;
+    long h = static_cast<long>(v.height);
+    double offset = 2 * v.y_center / v.scale;
+    if (!(std::abs(offset) < 2 * h) || std::abs(offset - std::round(offset)) > TOLERANCE) {
+        return {};
+    }
+    long axis = 2 * (h / 2) - std::lround(offset);
+    // пары по обе стороны оси: копии -- те, что после нее
+    long first = axis / 2 + 1;
+    long last = std::min(h, axis + 1);
+    if (axis < 0 || first >= last) {
+        return {};
+    }
+    return {static_cast<size_t>(first), static_cast<size_t>(last), static_cast<size_t>(axis)};
+}
+
+// при глубоком зуме точки сетки -- отклонения от центра, опорной точки орбиты
+static sample_grid tile_grid(const view &v, const tile_queue::tile &t) {
+    bool deep = deep_zoom(v);
+    return {static_cast<std::int64_t>(t.x) - static_cast<std::int64_t>(v.width / 2),
+            static_cast<std::int64_t>(t.y) - static_cast<std::int64_t>(v.height / 2),
+            t.precision, v.scale, deep ? 0 : v.x_center, deep ? 0 : v.y_center,
+            (t.w + t.precision - 1) / t.precision, (t.h + t.precision - 1) / t.precision};
+}
+
+// Отсчеты тайла t через каждые t.precision пикселей. reuse > 1 -- отсчеты
+// прошлого прохода уже скопированы в scratch.steps
+static bool calculate_tile(const view &v, const iteration &it, bool subdivide, size_t reuse,
+                           const tile_queue::tile &t, render_scratch &scratch,
+                           const cancel_flag &cancelled, render_stats &stats) {
+    sample_grid g = tile_grid(v, t);
+    scratch.steps.resize(g.w * g.h);
+    return compute_grid(g, it, subdivide, reuse, scratch.steps.data(), cancelled, stats);
+}
+
+// Отсчеты тайла между буфером итераций кадра и сеткой тайла; every -- только
+// каждый every-й отсчет сетки по обеим осям
+template <typename F>
+static void for_each_sample(const view &v, const tile_queue::tile &t, size_t every, F f) {
+    sample_grid g = tile_grid(v, t);
+    for (size_t j = 0; j < g.h; j += every) {
+        for (size_t i = 0; i < g.w; i += every) {
+            f(j * g.w + i, (t.y + j * t.precision) * v.width + t.x + i * t.precision);
+        }
+    }
+}
+
+// Числа итераций тайла t в полной точности, собранные из канонических тайлов
+// кеша (ближайшая точка сетки для каждого пикселя). compute -- досчитать
+// недостающие тайлы. false -- какого-то тайла нет (при compute -- кадр отменен)
+static bool compose_tile(const view &v, const iteration &it, bool subdivide, tile_cache &cache,
+                         const tile_queue::tile &t, bool compute, render_scratch &scratch,
+                         const cancel_flag &cancelled, render_stats &stats) {
+    const std::int64_t SIZE = tile_cache::SIZE;
+    int level = cache_level(v.scale);
+    double pixel = std::ldexp(1., -level);
+    scratch.columns.resize(t.w);
+    scratch.rows.resize(t.h);
+    for (size_t x = 0; x < t.w; ++x) {
+        double re = (static_cast<int>(t.x + x) - static_cast<int>(v.width / 2)) * v.scale + v.x_center;
+        scratch.columns[x] = std::llround(std::ldexp(re, level));
+    }
+    for (size_t y = 0; y < t.h; ++y) {
+        double im = (static_cast<int>(t.y + y) - static_cast<int>(v.height / 2)) * v.scale + v.y_center;
+        scratch.rows[y] = std::llround(std::ldexp(im, level));
+    }
+    std::int64_t tx0 = floor_div(scratch.columns.front(), SIZE);
+    std::int64_t ty0 = floor_div(scratch.rows.front(), SIZE);
+    std::int64_t nx = floor_div(scratch.columns.back(), SIZE) - tx0 + 1;
+    std::int64_t ny = floor_div(scratch.rows.back(), SIZE) - ty0 + 1;
+
+    scratch.cached.assign(nx * ny, nullptr);
+    for (std::int64_t ty = ty0; ty < ty0 + ny; ++ty) {
+        for (std::int64_t tx = tx0; tx < tx0 + nx; ++tx) {
+            tile_cache::key k{v.power, level, tx, ty};
+            auto steps = cache.find(k, v.max_steps);
+            if (!steps) {
+                if (!compute) {
+                    return false;
+                }
+                auto fresh = std::make_shared<tile_cache::steps_t>(SIZE * SIZE);
+                sample_grid g{tx * SIZE, ty * SIZE, 1, pixel, 0, 0, SIZE, SIZE};
+                if (!compute_grid(g, it, subdivide, 1, fresh->data(), cancelled, stats)) {
+                    return false;
+                }
+                cache.insert(k, v.max_steps, fresh);
+                steps = std::move(fresh);
+            }
+            scratch.cached[(ty - ty0) * nx + (tx - tx0)] = std::move(steps);
+        }
+    }
+
+    scratch.steps.resize(t.w * t.h);
+    for (size_t y = 0; y < t.h; ++y) {
+        std::int64_t ty = floor_div(scratch.rows[y], SIZE);
+        std::int64_t row = scratch.rows[y] - ty * SIZE;
+        for (size_t x = 0; x < t.w; ++x) {
+            std::int64_t tx = floor_div(scratch.columns[x], SIZE);
+            const auto &steps = *scratch.cached[(ty - ty0) * nx + (tx - tx0)];
+            // тайл мог быть посчитан с большим пределом: не вышедшие за v.max_steps
+            // шагов точки при нем -- не вышедшие
+            scratch.steps[y * t.w + x] = static_cast<std::uint16_t>(
+                    std::min<unsigned>(steps[row * SIZE + scratch.columns[x] - tx * SIZE], v.max_steps));
+        }
+    }
+    return true;
+}
+
+// Сглаживание тайла t, уже посчитанного в полной точности в scratch.steps: в
+// scratch.edges -- пиксели на границах (EDGE_STEPS), в scratch.subsamples -- по
+// SUBSAMPLES отсчетов каждого. Соседи за краем тайла считаются заново, рамкой в
+// пиксель, так что швы между тайлами сглаживаются как и все остальное. Соседние
+// такие пиксели строки считаются одной линией на каждое смещение
+static bool supersample_edges(const view &v, const iteration &it, const tile_queue::tile &t,
+                              render_scratch &scratch, const cancel_flag &cancelled, render_stats &stats) {
+    sample_grid g = tile_grid(v, t);
+    auto re = [&](std::int64_t i) { return static_cast<double>(g.x0 + i) * g.scale + g.x_center; };
+    auto im = [&](std::int64_t j) { return static_cast<double>(g.y0 + j) * g.scale + g.y_center; };
+    // тайл в рамке: строка w + 2 чисел, за краем кадра рамка повторяет край тайла
+    size_t fw = t.w + 2;
+    scratch.framed.resize(fw * (t.h + 2));
+    std::uint16_t *framed = scratch.framed.data();
+    for (size_t y = 0; y < t.h; ++y) {
+        memcpy(framed + (y + 1) * fw + 1, &scratch.steps[y * t.w], t.w * sizeof(std::uint16_t));
+    }
+    scratch.line.resize(std::max(t.w, t.h));
+    std::uint16_t *line = scratch.line.data();
+    auto count = [&](const std::uint16_t *samples, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            stats.iterations += samples[i];
+        }
+        stats.samples += n;
+    };
+    // сверху и снизу
+    for (size_t y : {size_t(0), t.h + 1}) {
+        std::uint16_t *row = framed + y * fw + 1;
+        if (y == 0 ? t.y > 0 : t.y + t.h < v.height) {
+            it.run(re(0), g.scale, im(static_cast<std::int64_t>(y) - 1), 0, t.w, row);
+            count(row, t.w);
+        } else {
+            memcpy(row, framed + (y == 0 ? 1 : t.h) * fw + 1, t.w * sizeof(std::uint16_t));
+        }
+    }
+    // слева и справа, столбцом
+    for (size_t x : {size_t(0), t.w + 1}) {
+        bool inside = x == 0 ? t.x > 0 : t.x + t.w < v.width;
+        if (inside) {
+            it.run(re(static_cast<std::int64_t>(x) - 1), 0, im(0), g.scale, t.h, line);
+            count(line, t.h);
+        }
+        for (size_t y = 0; y < t.h; ++y) {
+            framed[(y + 1) * fw + x] = inside ? line[y] : framed[(y + 1) * fw + (x == 0 ? 1 : t.w)];
+        }
+    }
+    auto differs = [&](unsigned a, unsigned b) {
+        return (a >= v.max_steps) != (b >= v.max_steps) || a >= b + EDGE_STEPS || b >= a + EDGE_STEPS;
+    };
+    auto edge = [&](size_t x, size_t y) {
+        const std::uint16_t *p = framed + (y + 1) * fw + x + 1;
+        return differs(*p, p[-1]) || differs(*p, p[1]) || differs(*p, p[-static_cast<std::ptrdiff_t>(fw)]) ||
+               differs(*p, p[fw]);
+    };
+    scratch.edges.clear();
+    scratch.subsamples.clear();
+    for (size_t y = 0; y < t.h; ++y) {
+        if (cancelled()) {
+            return false;
+        }
+        for (size_t x = 0; x < t.w; ++x) {
+            if (!edge(x, y)) {
+                continue;
+            }
+            size_t end = x + 1;
+            while (end < t.w && edge(end, y)) {
+                ++end;
+            }
+            size_t n = end - x;
+            size_t first = scratch.edges.size();
+            for (size_t i = x; i < end; ++i) {
+                scratch.edges.push_back(static_cast<std::uint32_t>(y * t.w + i));
+            }
+            scratch.subsamples.resize(scratch.subsamples.size() + n * SUBSAMPLES);
+            for (size_t k = 0; k < SUBSAMPLES; ++k) {
+                it.run(g.re(x) + SUBSAMPLE_OFFSETS[k][0] * g.scale, g.scale,
+                       g.im(y) + SUBSAMPLE_OFFSETS[k][1] * g.scale, 0, n, line);
+                for (size_t i = 0; i < n; ++i) {
+                    scratch.subsamples[(first + i) * SUBSAMPLES + k] = line[i];
+                }
+                count(line, n);
+            }
+            x = end;
+        }
+    }
+    return true;
+}
+
+// Числа итераций каждого пикселя тайла w x h (stride чисел на строку) по
+// сетке отсчетов через каждые precision пикселей
+static void expand(const std::uint16_t *steps, size_t w, size_t h, size_t precision,
+                   std::uint16_t *pixels, size_t stride) {
+    size_t columns = (w + precision - 1) / precision;
+    for (size_t y = 0; y < h; y += precision) {
+        const std::uint16_t *row = steps + y / precision * columns;
+        std::uint16_t *line = pixels + y * stride;
+        for (size_t x = 0; x < w; ++x) {
+            line[x] = row[x / precision];
+        }
+        for (size_t y_ = y + 1; y_ < h && y_ < y + precision; ++y_) {
+            memcpy(pixels + y_ * stride, line, w * sizeof(std::uint16_t));
+        }
+    }
+}
+
+bool render_tiles(tile_queue &queue, size_t version, size_t id, const view &v,
+                  const render_options &options, frame_buffer out, std::shared_mutex &publish_mutex,
+                  const cancel_flag &cancelled,
+                  const std::function<void(bool, bool)> &on_tile, render_stats &stats) {
+    iteration it{single_precision(v) ? select_float_kernel(v.power) : select_row_kernel(v.power),
+                 v.power, v.max_steps};
+    std::unique_ptr<reference_orbit> orbit;
+    if (deep_zoom(v)) {
+        // своя у каждого потока: max_steps итераций дешевле, чем делить ее между потоками
+        orbit = std::make_unique<reference_orbit>(double_double(v.x_center, v.x_center_lo),
+                                                  double_double(v.y_center, v.y_center_lo),
+                                                  static_cast<unsigned>(v.power), v.max_steps);
+        it.orbit = orbit.get();
+    }
+    // канонические тайлы кеша задаются в double, для глубокого зума они не годятся
+    tile_cache *cache = orbit ? nullptr : options.cache;
+    std::unique_ptr<palette> classic;
+    if (!options.colors) {
+        classic = std::make_unique<palette>(palette::classic, v.max_steps);
+    }
+    const palette &colors = options.colors ? *options.colors : *classic;
+    tile_queue::mirror mirror = real_axis_mirror(v);
+    render_scratch scratch;
+    tile_queue::tile t;
+    while (queue.next(version, v.width, v.height, options.first_precision, STEP_PRECISION,
+                      options.antialias, mirror, t)) {
+        auto start = std::chrono::steady_clock::now();
+        bool computed = false;
+        // тайл взят из картинки, где он уже записан в полной точности
+        bool in_frame = false;
+        size_t published = queue.published_precision(version, t);
+        // сглаживание: сначала тайл в полной точности, его мог еще не записать другой поток
+        bool smooth = t.precision == 0;
+        if (smooth) {
+            t.precision = 1;
+            if (out.steps && published == 1) {
+                scratch.steps.resize(t.w * t.h);
+                std::shared_lock frame_guard(publish_mutex);
+                std::lock_guard tile_guard(queue.tile_mutex(t));
+                if (cancelled()) {
+                    return false;
+                }
+                for (size_t y = 0; y < t.h; ++y) {
+                    memcpy(&scratch.steps[y * t.w], out.steps + (t.y + y) * v.width + t.x,
+                           t.w * sizeof(std::uint16_t));
+                }
+                computed = in_frame = true;
+            }
+        }
+        if (cache && !computed) {
+            // тайл уже собран из кеша в полной точности на грубом проходе
+            if (published <= t.precision) {
+                if (queue.finish(version, id, t, std::chrono::nanoseconds(0)) && on_tile) {
+                    on_tile(false, true);
+                }
+                continue;
+            }
+            bool compute = t.precision == 1;
+            if (compose_tile(v, it, options.subdivide, *cache, t, compute, scratch, cancelled, stats)) {
+                t.precision = 1;
+                computed = true;
+            } else if (compute) {
+                return false;
+            }
+        }
+        if (!computed) {
+            size_t reuse = 1;
+            if (out.steps && published == t.precision * STEP_PRECISION) {
+                // прошлый проход этого тайла уже записан, его отсчеты не пересчитываются
+                reuse = STEP_PRECISION;
+                sample_grid g = tile_grid(v, t);
+                scratch.steps.resize(g.w * g.h);
+                std::shared_lock frame_guard(publish_mutex);
+                std::lock_guard tile_guard(queue.tile_mutex(t));
+                // у отмененного кадра буфер мог смениться
+                if (cancelled()) {
+                    return false;
+                }
+                for_each_sample(v, t, reuse, [&](size_t grid, size_t frame) {
+                    scratch.steps[grid] = out.steps[frame];
+                });
+            }
+            if (!calculate_tile(v, it, options.subdivide, reuse, t, scratch, cancelled, stats)) {
+                return false;
+            }
+        }
+        if (smooth && !supersample_edges(v, it, t, scratch, cancelled, stats)) {
+            return false;
+        }
+        bool repaint = false;
+        {
+            // у сдвинутого кадра зеркальных строк нет, даже если они есть у вида
+            tile_queue::mirror m = queue.mirrored(version);
+            tile_queue::rect copy = m.reflect(t);
+            std::shared_lock frame_guard(publish_mutex);
+            cell_locks tile_guard(queue, t, copy);
+            if (cancelled()) {
+                return false;
+            }
+            size_t precision = t.precision;
+            if (smooth) {
+                t.precision = 0;
+            }
+            if (queue.try_publish(version, t)) {
+                // раскраска под блокировкой: палитру меняют вместе с перекраской кадра
+                std::uint16_t *pixels = out.steps + t.y * v.width + t.x;
+                size_t stride = v.width;
+                if (!out.steps) {
+                    scratch.pixels.resize(t.w * t.h);
+                    pixels = scratch.pixels.data();
+                    stride = t.w;
+                }
+                // сглаживание тайла из картинки меняет только цвета граничных пикселей
+                if (!in_frame) {
+                    expand(scratch.steps.data(), t.w, t.h, precision, pixels, stride);
+                }
+                if (out.data && !in_frame) {
+                    colors.colorize(pixels, stride, t.w, t.h, out.data + t.y * out.stride + 3 * t.x, out.stride);
+                }
+                if (smooth && out.data) {
+                    for (size_t i = 0; i < scratch.edges.size(); ++i) {
+                        size_t x = scratch.edges[i] % t.w;
+                        size_t y = scratch.edges[i] / t.w;
+                        colors.blend(&scratch.subsamples[i * SUBSAMPLES], SUBSAMPLES,
+                                     out.data + (t.y + y) * out.stride + 3 * (t.x + x));
+                    }
+                }
+                for (size_t y = copy.y; y < copy.y + copy.h; ++y) {
+                    size_t from = m.axis - y;
+                    if (out.data) {
+                        memcpy(out.data + y * out.stride + 3 * t.x, out.data + from * out.stride + 3 * t.x, 3 * t.w);
+                    }
+                    if (out.steps) {
+                        memcpy(out.steps + y * v.width + t.x, out.steps + from * v.width + t.x,
+                               t.w * sizeof(std::uint16_t));
+                    }
+                }
+                repaint = options.damage ? options.damage->add(t) : true;
+                if (options.damage && copy.h > 0) {
+                    options.damage->add(copy);
+                }
+            }
+        }
+        bool frame_done = queue.finish(version, id, t, std::chrono::steady_clock::now() - start);
+        if (on_tile) {
+            on_tile(repaint, frame_done);
+        }
+    }
+    if (queue.finish_empty(version) && on_tile) {
+        on_tile(false, true);
+    }
+    return true;
+}
+
+render_stats render(const view &v, const render_options &options, frame_buffer out,
+                    size_t n_threads, tile_queue::load_stats *load) {
+    std::vector<std::uint16_t> steps;
+    if (options.antialias && !out.steps) {
+        // иначе проходу сглаживания негде взять посчитанное в полной точности
+        steps.resize(v.width * v.height);
+        out.steps = steps.data();
+    }
+    tile_queue queue(n_threads);
+    std::shared_mutex publish_mutex;
+    std::vector<render_stats> stats(n_threads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&, i] {
+            render_tiles(queue, 1, i, v, options, out, publish_mutex, cancel_flag{}, nullptr, stats[i]);
+        });
+    }
+    render_stats total;
+    for (size_t i = 0; i < n_threads; ++i) {
+        threads[i].join();
+        total += stats[i];
+    }
+    if (load) {
+        *load = queue.stats();
+    }
+    return total;
+}
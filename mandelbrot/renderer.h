@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include "damage_tracker.h"
+#include "kernel.h"
+#include "palette.h"
+#include "sampler.h"
+#include "tile_cache.h"
+#include "tile_queue.h"
+
+// Вычисление кадров без Qt: на входе параметры вида, на выходе RGB-буфер,
+// по 3 байта на пиксель. Используется и виджетом, и консольной версией.
+
+constexpr double DEFAULT_SCALE = 0.005;
+// предел итераций при DEFAULT_SCALE; на каждое удвоение зума -- еще STEPS_PER_OCTAVE
+constexpr unsigned MAX_STEPS = 100;
+constexpr unsigned STEPS_PER_OCTAVE = 25;
+constexpr unsigned MIN_STEPS = 50;
+constexpr unsigned STEPS_LIMIT = 20000;  // числа итераций хранятся в uint16
+constexpr size_t FIRST_PRECISION = 9;
+constexpr size_t STEP_PRECISION = 3;
+// мельче double уже не различает соседние пиксели, считается по теории возмущений
+constexpr double DEEP_ZOOM_SCALE = 1e-12;
+// в уровне кеша этого масштаба и крупнее считается во float, векторами вдвое
+// шире: float расходится с double в десятых долях процента пикселей, а глубже
+// отличий быстро становится больше
+constexpr double FLOAT_SCALE = DEFAULT_SCALE;
+
+// Что рисуем: центр кадра, масштаб (единиц плоскости на пиксель) и степень
+struct view {
+    double x_center{0};
+    double y_center{0};
+    double scale{DEFAULT_SCALE};
+    double power{2};
+    size_t width{0};
+    size_t height{0};
+    double x_center_lo{0};  // младшие части центра в двойной-двойной точности,
+    double y_center_lo{0};  // нужны только глубокому зуму
+    unsigned max_steps{MAX_STEPS};
+};
+
+// Предел итераций по глубине зума: чем мельче пиксель, тем дольше живут
+// точки у границы множества, различимые на картинке
+unsigned max_steps_for(double scale);
+
+// Считать ли вид по теории возмущений
+bool deep_zoom(const view &v);
+
+// Считать ли вид во float
+bool single_precision(const view &v);
+
+// Строки кадра, зеркальные другим относительно вещественной оси: множество
+// симметрично при любой степени, и если ось проходит через кадр по сетке
+// пикселей, строки после нее, у которых есть пара до нее, копируются с пары.
+// При глубоком зуме -- пусто
+tile_queue::mirror real_axis_mirror(const view &v);
+
+struct frame_buffer {
+    unsigned char *data;             // nullptr -- только числа итераций, без раскраски
+    size_t stride;                   // байт на строку
+    std::uint16_t *steps{nullptr};   // числа итераций каждого пикселя, width * height; если
+                                     // есть, следующий проход не пересчитывает точки прошлого,
+                                     // а картинку можно перекрасить без пересчета
+};
+
+// Как считать кадр; одинаково для всех потоков
+struct render_options {
+    size_t first_precision{FIRST_PRECISION};  // 1 -- сразу в полной точности
+    tile_cache *cache{nullptr};
+    bool subdivide{true};                      // заливка по Мариани-Силверу
+    const palette *colors{nullptr};            // построенная для v.max_steps; меняется только под
+                                               // исключительной блокировкой публикации;
+                                               // nullptr -- classic
+    damage_tracker *damage{nullptr};           // куда добавлять записанные тайлы
+    bool antialias{false};                     // после полной точности -- проход сглаживания
+};
+
+// Один поток рендера: берет тайлы кадра version из queue, пока они есть, и
+// записывает их в out. Тайлы кадра не пересекаются и пишутся параллельно, под
+// разделяемой блокировкой publish_mutex; исключительную берет тот, кто меняет
+// картинку целиком (сдвиг) или начинает новый кадр. С кешем полная точность собирается
+// из канонических тайлов кеша, а полностью закешированные тайлы рисуются
+// сразу, без грубых проходов; при глубоком зуме кеш не используется. Тайл раскрашивается
+// при публикации, и в out.steps пишутся числа итераций всех его пикселей. Проход
+// сглаживания пересчитывает по нескольку отсчетов только в пикселях, число итераций
+// которых заметно отличается от соседа, в том числе за краем тайла; в out.steps
+// остаются отсчеты в центрах пикселей, так что перекраска сглаживание теряет.
+// Зеркальные строки кадра (real_axis_mirror) не считаются, а копируются при записи тайла с оригиналами,
+// под мьютексами клеток обоих. cancelled опрашивается раз в строку, on_tile
+// вызывается после каждого тайла: пора ли звать перерисовку (с options.damage -- только
+// первый тайл после забора, без него -- любой записанный) и последний ли это тайл кадра.
+// Возвращает false, если кадр отменен.
+bool render_tiles(tile_queue &queue, size_t version, size_t id, const view &v,
+                  const render_options &options, frame_buffer out, std::shared_mutex &publish_mutex,
+                  const cancel_flag &cancelled,
+                  const std::function<void(bool, bool)> &on_tile, render_stats &stats);
+
+// Кадр целиком на n_threads потоках; для сглаживания без out.steps буфер итераций
+// выделяется сам
+render_stats render(const view &v, const render_options &options, frame_buffer out,
+                    size_t n_threads, tile_queue::load_stats *load = nullptr);
@@ -0,0 +1,165 @@
+#include "sampler.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+constexpr std::uint16_t UNKNOWN = 0xffff;
+
+// меньшие прямоугольники считаются целиком, деление уже не окупается
+constexpr size_t MIN_SIZE = 4;
+
+// на более коротких отрезках прореженные линии хуже заполняют векторные
+// регистры, чем сэкономленные точки
+constexpr size_t MIN_LATTICE = 16;
+
+struct subdivider {
+    const sample_grid &g;
+    const iteration &it;
+    size_t reuse;
+    std::uint16_t *steps;
+    const cancel_flag &cancelled;
+    render_stats &stats;
+    std::vector<std::uint16_t> line{};
+
+    std::uint16_t &at(size_t i, size_t j) {
+        return steps[j * g.w + i];
+    }
+
+    // n точек (i + k * di, j + k * dj) одной линией через отдельный буфер,
+    // записываются только еще не посчитанные
+    void strided(size_t i, size_t j, size_t di, size_t dj, size_t n) {
+        line.resize(n);
+        double step = g.stride * g.scale;
+        it.run(g.re(i), di * step, g.im(j), dj * step, n, line.data());
+        count(line.data(), n);
+        for (size_t k = 0; k < n; ++k) {
+            std::uint16_t &cell = at(i + k * di, j + k * dj);
+            if (cell == UNKNOWN) {
+                cell = line[k];
+            }
+        }
+    }
+
+    // На линии прошлого прохода известна каждая reuse-я точка, остальные
+    // считаются reuse - 1 прореженными линиями
+    void lattice(size_t i, size_t j, size_t di, size_t dj, size_t from, size_t to) {
+        if (to - from + 1 < MIN_LATTICE) {
+            strided(di ? from : i, dj ? from : j, di, dj, to - from + 1);
+            return;
+        }
+        for (size_t r = 1; r < reuse; ++r) {
+            size_t first = (from + reuse - 1 - r) / reuse * reuse + r;
+            if (first <= to) {
+                strided(di ? first : i, dj ? first : j, di * reuse, dj * reuse, (to - first) / reuse + 1);
+            }
+        }
+    }
+
+    // еще не посчитанные точки строки j в [i0, i1], непрерывными отрезками
+    void row(size_t j, size_t i0, size_t i1) {
+        if (reuse > 1 && j % reuse == 0) {
+            lattice(0, j, 1, 0, i0, i1);
+            return;
+        }
+        for (size_t i = i0; i <= i1; ++i) {
+            if (at(i, j) != UNKNOWN) {
+                continue;
+            }
+            size_t end = i;
+            while (end < i1 && at(end + 1, j) == UNKNOWN) {
+                ++end;
+            }
+            it.run(g.re(i), g.stride * g.scale, g.im(j), 0, end - i + 1, &at(i, j));
+            count(&at(i, j), end - i + 1);
+            i = end;
+        }
+    }
+
+    void column(size_t i, size_t j0, size_t j1) {
+        if (reuse > 1 && i % reuse == 0) {
+            lattice(i, 0, 0, 1, j0, j1);
+            return;
+        }
+        for (size_t j = j0; j <= j1; ++j) {
+            if (at(i, j) != UNKNOWN) {
+                continue;
+            }
+            size_t end = j;
+            while (end < j1 && at(i, end + 1) == UNKNOWN) {
+                ++end;
+            }
+            strided(i, j, 0, 1, end - j + 1);
+            j = end;
+        }
+    }
+
+    void count(const std::uint16_t *computed, size_t n) {
+        stats.samples += n;
+        for (size_t k = 0; k < n; ++k) {
+            stats.iterations += computed[k];
+        }
+    }
+
+    // [x0, x1] x [y0, y1] с уже посчитанной границей
+    bool rect(size_t x0, size_t y0, size_t x1, size_t y1) {
+        if (cancelled()) {
+            return false;
+        }
+        std::uint16_t first = at(x0, y0);
+        bool uniform = true;
+        for (size_t i = x0; i <= x1 && uniform; ++i) {
+            uniform = at(i, y0) == first && at(i, y1) == first;
+        }
+        for (size_t j = y0; j <= y1 && uniform; ++j) {
+            uniform = at(x0, j) == first && at(x1, j) == first;
+        }
+        if (uniform) {
+            for (size_t j = y0 + 1; j < y1; ++j) {
+                std::fill(&at(x0 + 1, j), &at(x1, j), first);
+            }
+            return true;
+        }
+        if (x1 - x0 < MIN_SIZE || y1 - y0 < MIN_SIZE) {
+            for (size_t j = y0 + 1; j < y1; ++j) {
+                row(j, x0 + 1, x1 - 1);
+            }
+            return true;
+        }
+        size_t xm = (x0 + x1) / 2;
+        size_t ym = (y0 + y1) / 2;
+        row(ym, x0 + 1, x1 - 1);
+        column(xm, y0 + 1, y1 - 1);
+        return rect(x0, y0, xm, ym) && rect(xm, y0, x1, ym) &&
+               rect(x0, ym, xm, y1) && rect(xm, ym, x1, y1);
+    }
+};
+
+}
+
+bool compute_grid(const sample_grid &g, const iteration &it, bool subdivide, size_t reuse,
+                  std::uint16_t *steps, const cancel_flag &cancelled, render_stats &stats) {
+    reuse = std::max<size_t>(reuse, 1);
+    subdivider s{g, it, reuse, steps, cancelled, stats};
+    for (size_t j = 0; j < g.h; ++j) {
+        for (size_t i = 0; i < g.w; ++i) {
+            if (i % reuse != 0 || j % reuse != 0 || reuse == 1) {
+                s.at(i, j) = UNKNOWN;
+            }
+        }
+    }
+    if (!subdivide || g.w < MIN_SIZE || g.h < MIN_SIZE) {
+        for (size_t j = 0; j < g.h; ++j) {
+            if (cancelled()) {
+                return false;
+            }
+            s.row(j, 0, g.w - 1);
+        }
+        return true;
+    }
+    s.row(0, 0, g.w - 1);
+    s.row(g.h - 1, 0, g.w - 1);
+    s.column(0, 1, g.h - 2);
+    s.column(g.w - 1, 1, g.h - 2);
+    return s.rect(0, 0, g.w - 1, g.h - 1);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include "kernel.h"
+#include "perturbation.h"
+
+// Прямоугольная сетка отсчетов: точка (i, j) сетки -- это
+// ((x0 + i * stride) * scale + x_center, (y0 + j * stride) * scale + y_center)
+struct sample_grid {
+    std::int64_t x0;
+    std::int64_t y0;
+    size_t stride;
+    double scale;
+    double x_center;
+    double y_center;
+    size_t w;
+    size_t h;
+
+    double re(size_t i) const {
+        return (x0 + static_cast<std::int64_t>(i * stride)) * scale + x_center;
+    }
+
+    double im(size_t j) const {
+        return (y0 + static_cast<std::int64_t>(j * stride)) * scale + y_center;
+    }
+};
+
+struct render_stats {
+    std::uint64_t samples{0};     // посчитанных точек, без залитых и размноженных
+    std::uint64_t iterations{0};  // итераций в посчитанных точках
+
+    render_stats &operator+=(const render_stats &other) {
+        samples += other.samples;
+        iterations += other.iterations;
+        return *this;
+    }
+};
+
+// Отмена кадра: кадр отменен, когда version ушла от expected. Опрашивается
+// часто, поэтому без std::function и с relaxed-чтением: упорядочивание записей
+// в картинку обеспечивает мьютекс публикации, а не эта проверка.
+// Без version кадр не отменяется
+struct cancel_flag {
+    const std::atomic_size_t *version{nullptr};
+    size_t expected{0};
+
+    bool operator()() const {
+        return version && version->load(std::memory_order_relaxed) != expected;
+    }
+};
+
+// Чем итерировать: ядро, выбранное для степени, и предел числа итераций.
+// С опорной орбитой точки сетки -- отклонения от опорной точки
+struct iteration {
+    row_kernel kernel;
+    double power;
+    unsigned max_steps;
+    const reference_orbit *orbit{nullptr};
+
+    // count точек линии, как у row_kernel
+    void run(double re, double re_step, double im, double im_step, size_t count,
+             std::uint16_t *steps) const {
+        if (orbit) {
+            orbit->iterate(re, re_step, im, im_step, count, max_steps, steps);
+        } else {
+            kernel(re, re_step, im, im_step, count, power, max_steps, steps);
+        }
+    }
+};
+
+// Считает числа итераций всех точек сетки в steps (w * h, по строкам).
+// subdivide -- по Мариани-Силверу: сначала граница прямоугольника, и если
+// на ней везде одно и то же число итераций, прямоугольник заливается без
+// вычислений, иначе делится на четыре. reuse > 1 -- в steps уже лежат
+// отсчеты прошлого прохода, в точках с i и j, кратными reuse; они не
+// пересчитываются. false -- вычисление отменено
+bool compute_grid(const sample_grid &g, const iteration &it, bool subdivide, size_t reuse,
+                  std::uint16_t *steps, const cancel_flag &cancelled, render_stats &stats);
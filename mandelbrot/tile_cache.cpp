@@ -0,0 +1,60 @@
+#include "tile_cache.h"
+#include <cstring>
+#include <functional>
+
+size_t tile_cache::key_hash::operator()(const key &k) const {
+    std::uint64_t power_bits;
+    std::memcpy(&power_bits, &k.power, sizeof(power_bits));
+    size_t h = std::hash<std::uint64_t>()(power_bits);
+    for (std::uint64_t part : {std::uint64_t(k.level), std::uint64_t(k.tx), std::uint64_t(k.ty)}) {
+        h ^= std::hash<std::uint64_t>()(part) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+tile_cache::tile_cache(size_t max_bytes) : max_bytes(max_bytes) {}
+
+std::shared_ptr<const tile_cache::steps_t> tile_cache::find(const key &k, unsigned max_steps) {
+    std::lock_guard guard(mutex_);
+    auto it = index.find(k);
+    if (it == index.end() || it->second->max_steps < max_steps) {
+        return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->steps;
+}
+
+void tile_cache::insert(const key &k, unsigned max_steps, std::shared_ptr<const steps_t> steps) {
+    std::lock_guard guard(mutex_);
+    auto it = index.find(k);
+    if (it != index.end()) {
+        // тот же тайл мог параллельно посчитать другой поток
+        if (it->second->max_steps < max_steps) {
+            it->second->max_steps = max_steps;
+            it->second->steps = std::move(steps);
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+    lru.push_front(entry{k, max_steps, std::move(steps)});
+    index.emplace(k, lru.begin());
+    evict();
+}
+
+void tile_cache::set_limit(size_t max_bytes) {
+    std::lock_guard guard(mutex_);
+    this->max_bytes = max_bytes;
+    evict();
+}
+
+size_t tile_cache::memory_usage() const {
+    std::lock_guard guard(mutex_);
+    return index.size() * TILE_BYTES;
+}
+
+void tile_cache::evict() {
+    while (!lru.empty() && index.size() * TILE_BYTES > max_bytes) {
+        index.erase(lru.back().k);
+        lru.pop_back();
+    }
+}
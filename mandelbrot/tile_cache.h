@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Кеш посчитанных тайлов с числами итераций. Тайлы лежат на канонической
+// сетке: на уровне level пиксель имеет размер 2^-level, тайл (tx, ty)
+// содержит точки (i, j) * 2^-level для i, j в [t * SIZE, (t + 1) * SIZE).
+// Поэтому кадры с разными центрами и близкими масштабами делят тайлы, а
+// возврат к недавно виденному виду не требует вычислений.
+// Предел итераций не входит в ключ: тайл хранится с пределом, с которым
+// посчитан, и годится любому кадру с пределом не больше -- читающий обрезает
+// числа итераций до своего. Так зум туда и обратно попадает в кеш, даже если
+// планировщик кадров между ними менял предел.
+// Вытесняются давно не использованные тайлы, когда кеш превышает лимит.
+class tile_cache {
+public:
+    constexpr static size_t SIZE = 64;
+
+    struct key {
+        double power;
+        int level;
+        std::int64_t tx;
+        std::int64_t ty;
+
+        bool operator==(const key &other) const {
+            return power == other.power && level == other.level && tx == other.tx && ty == other.ty;
+        }
+    };
+
+    using steps_t = std::vector<std::uint16_t>;  // SIZE * SIZE, по строкам
+
+    explicit tile_cache(size_t max_bytes);
+
+    // nullptr, если тайла нет или он посчитан с пределом меньше max_steps
+    std::shared_ptr<const steps_t> find(const key &k, unsigned max_steps);
+
+    // Заменяет тайл, посчитанный с меньшим пределом
+    void insert(const key &k, unsigned max_steps, std::shared_ptr<const steps_t> steps);
+
+    void set_limit(size_t max_bytes);
+
+    size_t memory_usage() const;
+
+    // Память одного тайла вместе с накладными расходами контейнеров
+    constexpr static size_t TILE_BYTES = SIZE * SIZE * sizeof(std::uint16_t) + 128;
+
+private:
+    struct key_hash {
+        size_t operator()(const key &k) const;
+    };
+
+    struct entry {
+        key k;
+        unsigned max_steps;
+        std::shared_ptr<const steps_t> steps;
+    };
+
+    using lru_t = std::list<entry>;
+
+    void evict();
+
+    mutable std::mutex mutex_;
+    size_t max_bytes;
+    lru_t lru;  // в начале -- недавно использованные
+    std::unordered_map<key, lru_t::iterator, key_hash> index;
+};
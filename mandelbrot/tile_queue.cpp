@@ -0,0 +1,199 @@
+#include "tile_queue.h"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+tile_queue::tile_queue(size_t n_threads) {
+    load.busy.resize(n_threads);
+    load.tiles.resize(n_threads);
+}
+
+tile_queue::rect tile_queue::mirror::reflect(const rect &r) const {
+    long y0 = std::max(static_cast<long>(first), static_cast<long>(axis) - static_cast<long>(r.y + r.h) + 1);
+    long y1 = std::min(static_cast<long>(last), static_cast<long>(axis) - static_cast<long>(r.y) + 1);
+    if (y0 >= y1) {
+        return {r.x, 0, r.w, 0};
+    }
+    return {r.x, static_cast<size_t>(y0), r.w, static_cast<size_t>(y1 - y0)};
+}
+
+void tile_queue::split(const rect &r) {
+    for (size_t y = r.y / TILE_SIZE * TILE_SIZE; y < r.y + r.h; y += TILE_SIZE) {
+        for (size_t x = r.x / TILE_SIZE * TILE_SIZE; x < r.x + r.w; x += TILE_SIZE) {
+            size_t x0 = std::max(x, r.x);
+            size_t y0 = std::max(y, r.y);
+            tiles.push_back({x0, y0, std::min(x + TILE_SIZE, r.x + r.w) - x0,
+                             std::min(y + TILE_SIZE, r.y + r.h) - y0});
+        }
+    }
+}
+
+bool tile_queue::next(size_t version, size_t w, size_t h, size_t first_precision,
+                      size_t step_precision, bool antialias, const mirror &m, tile &t) {
+    std::lock_guard guard(mutex_);
+    if (version < this->version) {
+        return false;
+    }
+    if (version > this->version) {
+        this->version = version;
+        this->w = w;
+        this->h = h;
+        tiles.clear();
+        reflection = {};
+        if (version == pending_version) {
+            for (const rect &r : pending) {
+                split(r);
+            }
+        } else if (m.first < m.last) {
+            reflection = m;
+            split({0, 0, w, m.first});
+            split({0, m.last, w, h - m.last});
+        } else {
+            split({0, 0, w, h});
+        }
+        pending.clear();
+        precisions.clear();
+        for (size_t p = first_precision; p > 0; p /= step_precision) {
+            precisions.push_back(p);
+        }
+        if (antialias) {
+            precisions.push_back(0);
+        }
+        next_tile = 0;
+        finished = 0;
+        published.assign(tiles.size(), std::numeric_limits<size_t>::max());
+        started = std::chrono::steady_clock::now();
+        std::fill(load.busy.begin(), load.busy.end(), std::chrono::nanoseconds(0));
+        std::fill(load.tiles.begin(), load.tiles.end(), 0);
+        load.done = false;
+        load.wall = std::chrono::nanoseconds(0);
+        load.first_samples = 0;
+        load.first_pass = std::chrono::nanoseconds(0);
+    }
+    if (next_tile == tiles.size() * precisions.size()) {
+        return false;
+    }
+    size_t index = next_tile % tiles.size();
+    static_cast<rect &>(t) = tiles[index];
+    t.precision = precisions[next_tile / tiles.size()];
+    t.index = index;
+    ++next_tile;
+    return true;
+}
+
+bool tile_queue::finish(size_t version, size_t id, const tile &t, std::chrono::nanoseconds busy) {
+    std::lock_guard guard(mutex_);
+    if (version != this->version) {
+        return false;
+    }
+    load.busy[id] += busy;
+    ++load.tiles[id];
+    auto now = std::chrono::steady_clock::now();
+    if (t.precision == precisions.front()) {
+        load.first_samples += (t.w + t.precision - 1) / t.precision * ((t.h + t.precision - 1) / t.precision);
+        load.first_pass = now - started;
+    }
+    if (++finished == tiles.size() * precisions.size()) {
+        load.done = true;
+        load.wall = now - started;
+        return true;
+    }
+    return false;
+}
+
+bool tile_queue::finish_empty(size_t version) {
+    std::lock_guard guard(mutex_);
+    if (version != this->version || !tiles.empty() || load.done) {
+        return false;
+    }
+    load.done = true;
+    load.wall = std::chrono::steady_clock::now() - started;
+    return true;
+}
+
+bool tile_queue::try_publish(size_t version, const tile &t) {
+    std::lock_guard guard(mutex_);
+    if (version != this->version || published[t.index] <= t.precision) {
+        return false;
+    }
+    published[t.index] = t.precision;
+    return true;
+}
+
+std::mutex &tile_queue::tile_mutex(const tile &t) {
+    return tile_mutex(t.x, t.y);
+}
+
+std::mutex &tile_queue::tile_mutex(size_t x, size_t y) {
+    // соседние клетки и по горизонтали, и по вертикали -- у разных мьютексов
+    return tile_mutexes[(x / TILE_SIZE + y / TILE_SIZE * 17) % TILE_MUTEXES];
+}
+
+tile_queue::mirror tile_queue::mirrored(size_t version) const {
+    std::lock_guard guard(mutex_);
+    return version == this->version ? reflection : mirror{};
+}
+
+size_t tile_queue::published_precision(size_t version, const tile &t) const {
+    std::lock_guard guard(mutex_);
+    return version == this->version ? published[t.index] : 0;
+}
+
+bool tile_queue::shift(size_t version, size_t w, size_t h, long dx, long dy) {
+    std::lock_guard guard(mutex_);
+    std::vector<rect> dirty;
+    if (pending_version > this->version) {
+        dirty = std::move(pending);
+    } else {
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            if (published[i] != precisions.back()) {
+                dirty.push_back(tiles[i]);
+                // зеркальная копия недосчитанного тайла тоже недосчитана
+                rect copy = reflection.reflect(tiles[i]);
+                if (copy.h > 0) {
+                    dirty.push_back(copy);
+                }
+            }
+        }
+    }
+    // сдвигать можно только кадр, непосредственно предшествующий новому
+    size_t base = std::max(pending_version, this->version);
+    pending.clear();
+    if (base == 0 || base + 1 != version) {
+        return false;
+    }
+    long lw = static_cast<long>(w);
+    long lh = static_cast<long>(h);
+    if (w != this->w || h != this->h || std::abs(dx) >= lw || std::abs(dy) >= lh) {
+        return false;
+    }
+
+    auto add = [&](long x0, long y0, long x1, long y1) {
+        x0 = std::max(x0, 0l);
+        y0 = std::max(y0, 0l);
+        x1 = std::min(x1, lw);
+        y1 = std::min(y1, lh);
+        if (x0 < x1 && y0 < y1) {
+            pending.push_back({size_t(x0), size_t(y0), size_t(x1 - x0), size_t(y1 - y0)});
+        }
+    };
+    for (const rect &r : dirty) {
+        long x = static_cast<long>(r.x) + dx;
+        long y = static_cast<long>(r.y) + dy;
+        add(x, y, x + static_cast<long>(r.w), y + static_cast<long>(r.h));
+    }
+    // открывшиеся полосы: вертикальная на всю высоту, горизонтальная без угла
+    add(dx > 0 ? 0 : lw + dx, 0, dx > 0 ? dx : lw, lh);
+    add(dx > 0 ? dx : 0, dy > 0 ? 0 : lh + dy, dx > 0 ? lw : lw + dx, dy > 0 ? dy : lh);
+    if (pending.size() > MAX_DIRTY) {
+        pending.clear();
+        return false;
+    }
+    pending_version = version;
+    return true;
+}
+
+tile_queue::load_stats tile_queue::stats() const {
+    std::lock_guard guard(mutex_);
+    return load;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Общая очередь тайлов кадра. Потоки берут следующий тайл, пока они не
+// кончатся, поэтому освободившийся поток забирает работу у занятых, а не
+// простаивает до конца своей полосы. Тайлы выдаются по проходам:
+// сначала все тайлы грубого прохода, затем более точного. Проход с точностью
+// 0 -- сглаживание тайлов, уже посчитанных в полной точности. Строки,
+// зеркальные другим строкам кадра, в тайлы не попадают.
+class tile_queue {
+public:
+    // кратно точностям всех проходов, чтобы сетка отсчетов не зависела от тайла
+    constexpr static size_t TILE_SIZE = 72;
+
+    struct rect {
+        size_t x;
+        size_t y;
+        size_t w;
+        size_t h;
+    };
+
+    struct tile : rect {
+        size_t precision;
+        size_t index;  // номер тайла в кадре, общий для всех проходов
+    };
+
+    // Строки [first, last) -- зеркальные копии строк axis - y: не считаются, а
+    // копируются при записи тайлов, в которые попали их оригиналы
+    struct mirror {
+        size_t first{0};
+        size_t last{0};
+        size_t axis{0};
+
+        // Строки r, отраженные в [first, last); h == 0 -- туда не попало ничего
+        rect reflect(const rect &r) const;
+    };
+
+    struct load_stats {
+        bool done{false};  // все тайлы записаны или считать было нечего
+        std::chrono::nanoseconds wall{0};
+        std::vector<std::chrono::nanoseconds> busy;  // по потокам
+        std::vector<size_t> tiles;
+        // законченные тайлы первого прохода: их отсчеты и время от начала кадра
+        // до последнего из них; по ним оценивается стоимость следующего кадра
+        size_t first_samples{0};
+        std::chrono::nanoseconds first_pass{0};
+    };
+
+    explicit tile_queue(size_t n_threads);
+
+    // Следующий тайл кадра version. Первый запрос с более новой версией
+    // начинает новый кадр; antialias -- со сглаживанием после полной точности,
+    // m -- зеркальные строки; сдвинутому кадру (shift) они не нужны, его полосы
+    // считаются целиком. false -- тайлы кончились или кадр устарел
+    bool next(size_t version, size_t w, size_t h, size_t first_precision,
+              size_t step_precision, bool antialias, const mirror &m, tile &t);
+
+    // Зеркальные строки кадра version; пусто, если их нет или кадр устарел
+    mirror mirrored(size_t version) const;
+
+    // Тайл t посчитан потоком id за время busy.
+    // true -- это был последний тайл кадра
+    bool finish(size_t version, size_t id, const tile &t, std::chrono::nanoseconds busy);
+
+    // Тайлы кончились, а кадр version мог их и не иметь: сдвиг, после которого
+    // досчитывать нечего. Такой кадр закончен сразу; true -- это кадр без
+    // тайлов, и позвавший первым
+    bool finish_empty(size_t version);
+
+    // Можно ли записать тайл в картинку: поздно законченный грубый тайл не
+    // должен затереть уже записанный точный. Вызывать под tile_mutex(t)
+    bool try_publish(size_t version, const tile &t);
+
+    // Мьютекс записи тайла в картинку: проходы одного тайла пишут по очереди,
+    // разные тайлы -- почти всегда параллельно. Тайлы не выходят за клетки
+    // сетки TILE_SIZE, и мьютекс -- у клетки, так что им же можно закрыть
+    // чтение клетки с пикселем (x, y) из картинки
+    std::mutex &tile_mutex(const tile &t);
+    std::mutex &tile_mutex(size_t x, size_t y);
+
+    // Точность, с которой тайл уже записан в картинку; SIZE_MAX -- еще не
+    // записан, 0 -- кадр устарел
+    size_t published_precision(size_t version, const tile &t) const;
+
+    // Кадр version -- предыдущий, сдвинутый на (dx, dy) пикселей. Считать
+    // нужно только открывшиеся полосы и то, что в предыдущем кадре не
+    // досчитано до конца. Вызывать под исключительной блокировкой
+    // публикации, после смены
+    // версии и до сдвига картинки. false -- кадр надо считать целиком
+    bool shift(size_t version, size_t w, size_t h, long dx, long dy);
+
+    // Загрузка потоков в текущем кадре
+    load_stats stats() const;
+
+private:
+    // больше -- проще посчитать кадр заново
+    constexpr static size_t MAX_DIRTY = 256;
+
+    constexpr static size_t TILE_MUTEXES = 64;
+
+    void split(const rect &r);
+
+    mutable std::mutex mutex_;
+    size_t version{0};
+    size_t w{0};
+    size_t h{0};
+    std::vector<rect> tiles;
+    std::vector<size_t> precisions;
+    mirror reflection;
+    size_t next_tile{0};
+    size_t finished{0};
+
+    std::vector<size_t> published;  // точность записанного тайла
+    std::array<std::mutex, TILE_MUTEXES> tile_mutexes;
+
+    // сдвинутый кадр, который еще не начали считать
+    size_t pending_version{0};
+    std::vector<rect> pending;
+
+    std::chrono::steady_clock::time_point started;
+    load_stats load;
+};
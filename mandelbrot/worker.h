@@ -1,10 +1,14 @@
 #pragma once
 #include <QObject>
-#include <QImage>
 #include <mutex>
+#include <shared_mutex>
 #include <atomic>
 #include <memory>
 #include <thread>
+#include <vector>
+#include "render_job.h"
+#include "renderer.h"
+#include "tile_queue.h"
 
 class worker : public QObject {
     Q_OBJECT
@@ -15,36 +19,27 @@ public:
     worker() = default;
     ~worker() = default;
     void set_id(size_t id);
-    void set_mutex(std::mutex *publish_mutex);
-    size_t set_input(std::shared_ptr<QImage> img_ptr);
-    size_t set_center_and_scale(double new_x, double new_y, double new_scale);
-    size_t move_center(double delta_x, double delta_y);
-    size_t set_power(double power);
-    size_t reset();
-    void cancel();
+    void set_mutex(std::shared_mutex *publish_mutex);
+    void set_queue(tile_queue *queue);
+    void set_cache(tile_cache *cache);
+    void set_palette(const palette *colors);
+    void set_damage(damage_tracker *damage);
+    void set_jobs(const job_board *jobs);
 
 public slots:
             void calculate(size_t local_version);
 
     signals:
-            void calculation_finished(std::shared_ptr<QImage> img_ptr);
+            void calculation_finished();
 
 private:
-    void calculate_image(size_t local_version, size_t precision);
-    double value(int x, int y, int w, int h, double power) const;
-
-    constexpr static size_t FIRST_PRECISION = 9;
-    constexpr static double STEP_PRECISION = 3;
-
-    double scale{0.005};
-    double x_center{0};
-    double y_center{0};
-    double power{2};
-
-    std::atomic_size_t version{0};
-    std::mutex mutex_{};
+    static void log_load(const tile_queue::load_stats &stats);
 
     size_t id;
-    std::mutex *publish_mutex;
-    std::shared_ptr<QImage> img_ptr;
+    std::shared_mutex *publish_mutex;
+    tile_queue *queue;
+    tile_cache *cache{nullptr};
+    const palette *colors{nullptr};
+    damage_tracker *damage{nullptr};
+    const job_board *jobs{nullptr};
 };